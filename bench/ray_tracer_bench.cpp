@@ -0,0 +1,357 @@
+#include <toy_tracer/camera.hpp>
+#include <toy_tracer/math.hpp>
+#include <toy_tracer/mesh.hpp>
+#include <toy_tracer/renderer.hpp>
+#include <toy_tracer/scene_node.hpp>
+#include <toy_tracer/trace_recorder.hpp>
+#include <toy_tracer/world.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifndef TOY_TRACER_DATA_DIR
+#define TOY_TRACER_DATA_DIR "../data"
+#endif
+
+/*
+ * Renders a fixed matrix of scenes and prints the measurements as JSON to
+ * stdout, progress goes to stderr. Every render uses the same resolution,
+ * sample count and seed, so runs on the same machine are comparable.
+ *
+ * Usage: RayTracerBench [--max-triangles N] [--max-threads N] [--trace FILE]
+ *
+ * --trace writes a Chrome trace of the whole run, which needs a build with
+ * TOY_TRACER_ENABLE_TRACE. Only the latest events of each thread are kept.
+ */
+
+using Vector3 = toy_tracer::math::Vector<float, 3>;
+using Clock   = std::chrono::steady_clock;
+
+namespace
+{
+constexpr int width             = 320;
+constexpr int height            = 240;
+constexpr int samples           = 4;
+constexpr std::uint64_t seed    = 1;
+constexpr int instanceGridWidth = 100;
+
+struct Options {
+    std::size_t maxTriangles = 10000000;
+    std::size_t maxThreads   = std::max(1u, std::thread::hardware_concurrency());
+    std::string traceFile;
+};
+
+double msSince(Clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+/**
+ * @brief Renderable that is never hit but whose bounds contain the whole
+ * scene, so the world visits it exactly once per traced ray
+ */
+class RayCounter final : public toy_tracer::SceneObject, public toy_tracer::Renderable {
+  public:
+    std::optional<toy_tracer::HitRecord> hit(const toy_tracer::Ray&) const noexcept override
+    {
+        count_.fetch_add(1, std::memory_order_relaxed);
+        return std::nullopt;
+    }
+
+    toy_tracer::Aabb bounds() const noexcept override
+    {
+        toy_tracer::Aabb bounds;
+        bounds.grow(Vector3{ -1.0e6f, -1.0e6f, -1.0e6f });
+        bounds.grow(Vector3{ 1.0e6f, 1.0e6f, 1.0e6f });
+        return bounds;
+    }
+
+    std::uint64_t count() const noexcept
+    {
+        return count_.load();
+    }
+
+  protected:
+    void notifyNodeUpdated() override {}
+    void notifyAttached(toy_tracer::SceneNode*) override {}
+    void notifyDetached() override {}
+
+  private:
+    mutable std::atomic<std::uint64_t> count_{ 0 };
+};
+
+/**
+ * @brief Sphere with a wavy surface made of about the given number of triangles
+ */
+std::vector<toy_tracer::Triangle> makeBlob(std::size_t triangles)
+{
+    const std::size_t rings    = std::max<std::size_t>(3, static_cast<std::size_t>(std::sqrt(triangles / 4.0)));
+    const std::size_t segments = 2 * rings;
+    const float pi             = 3.14159265358979f;
+    const auto point           = [&](std::size_t ring, std::size_t segment) {
+        const float theta  = pi * static_cast<float>(ring) / static_cast<float>(rings);
+        const float phi    = 2.0f * pi * static_cast<float>(segment % segments) / static_cast<float>(segments);
+        const float radius = 1.0f + 0.05f * std::sin(12.0f * theta) * std::sin(12.0f * phi);
+        return Vector3{ radius * std::sin(theta) * std::cos(phi), radius * std::cos(theta),
+                        radius * std::sin(theta) * std::sin(phi) };
+    };
+
+    std::vector<toy_tracer::Triangle> result;
+    result.reserve(2 * rings * segments);
+    for (std::size_t ring = 0; ring < rings; ++ring) {
+        for (std::size_t segment = 0; segment < segments; ++segment) {
+            const Vector3 a = point(ring, segment);
+            const Vector3 b = point(ring, segment + 1);
+            const Vector3 c = point(ring + 1, segment);
+            const Vector3 d = point(ring + 1, segment + 1);
+            if (ring != 0) {
+                result.emplace_back(a, b, d);
+            }
+            if (ring + 1 != rings) {
+                result.emplace_back(a, d, c);
+            }
+        }
+    }
+    return result;
+}
+
+/**
+ * @brief The counters of the render with the most threads, only with TOY_TRACER_ENABLE_STATS
+ */
+void printStats(const toy_tracer::RenderStats& stats)
+{
+    const toy_tracer::RenderCounters& counters = stats.counters;
+    const double rays                          = static_cast<double>(std::max<std::uint64_t>(1, counters.totalRays()));
+    std::printf("      \"stats\": {\n");
+    std::printf("        \"raysByDepth\": [");
+    for (std::size_t i = 0; i < toy_tracer::RenderCounters::depthCount; ++i) {
+        std::printf("%s%llu", i == 0 ? "" : ", ", static_cast<unsigned long long>(counters.rays[i]));
+    }
+    std::printf("],\n");
+    std::printf("        \"hitRatio\": %.4f,\n", counters.hitRatio());
+    std::printf("        \"boxTestsPerRay\": %.2f,\n", counters.boxTests / rays);
+    std::printf("        \"triangleTestsPerRay\": %.2f,\n", counters.triangleTests / rays);
+    std::printf("        \"wallMs\": %.3f,\n", stats.wallMs);
+    std::printf("        \"threads\": [");
+    for (std::size_t i = 0; i < stats.threads.size(); ++i) {
+        std::printf("%s\n          { \"busyMs\": %.3f, \"idleMs\": %.3f, \"tiles\": %zu }", i == 0 ? "" : ",",
+                    stats.threads[i].busyMs, stats.threads[i].idleMs, stats.threads[i].tiles);
+    }
+    std::printf("\n        ]\n");
+    std::printf("      }\n");
+}
+
+struct SceneSpec {
+    std::string name;
+    std::shared_ptr<const toy_tracer::MeshGeometry> geometry;
+    double loadMs;
+    int instances;
+};
+
+/**
+ * @brief Build the scene of a spec, measure it and print it as one JSON object
+ */
+void benchmark(const SceneSpec& spec, const Options& options, bool first)
+{
+    std::fprintf(stderr, "%s: %zu triangles, %d instances\n", spec.name.c_str(),
+                 spec.geometry->triangleCount(), spec.instances);
+
+    toy_tracer::SceneGraph graph;
+    toy_tracer::World world;
+    graph.addObserver(&world);
+
+    toy_tracer::Camera camera(4, 3, 1.0f);
+    toy_tracer::SceneNode cameraNode("camera");
+    cameraNode.attach(&camera);
+    graph.rootNode().attach(&cameraNode);
+
+    toy_tracer::SceneNode floorNode("floor");
+    toy_tracer::Mesh floor(std::vector<toy_tracer::Triangle>{
+        toy_tracer::Triangle({ { -1.0f, 0.0f, 1.0f }, { -1.0f, 0.0f, -1.0f }, { 1.0f, 0.0f, -1.0f } }),
+        toy_tracer::Triangle({ { -1.0f, 0.0f, 1.0f }, { 1.0f, 0.0f, -1.0f }, { 1.0f, 0.0f, 1.0f } }) });
+    floorNode.attach(&floor);
+
+    // Every instance is scaled to a size of 2, one instance is placed like
+    // the mesh of the example, more are placed on a grid seen from above
+    const toy_tracer::Aabb local = spec.geometry->bounds();
+    const Vector3 extent         = local.max - local.min;
+    const float scale            = 2.0f / std::max({ extent[0], extent[1], extent[2] });
+    const int columns            = std::min(spec.instances, instanceGridWidth);
+    std::vector<toy_tracer::SceneNode*> nodes;
+    std::vector<std::unique_ptr<toy_tracer::Mesh>> meshes;
+    for (int i = 0; i < spec.instances; ++i) {
+        nodes.push_back(graph.createNode("mesh"));
+        meshes.push_back(std::make_unique<toy_tracer::Mesh>(spec.geometry));
+        nodes.back()->attach(meshes.back().get());
+        nodes.back()->setScale(Vector3{ scale, scale, scale });
+        nodes.back()->rotateX(toy_tracer::math::degToRad(80.0f));
+        nodes.back()->setPos(Vector3{ 2.5f * static_cast<float>(i % columns - columns / 2), 0.0f, 2.5f * static_cast<float>(i / columns) });
+        graph.rootNode().attach(nodes.back());
+    }
+    const float floorSize = std::max(10.0f, 2.5f * static_cast<float>(columns));
+    cameraNode.setPos(spec.instances == 1 ? Vector3{ 0.0f, -0.25f, -1.8f } : Vector3{ 0.0f, -4.0f, -6.0f });
+    floorNode.translate(Vector3{ 0.0f, 1.5f, floorSize - 2.0f });
+    floorNode.scale(Vector3{ floorSize, floorSize, floorSize });
+    graph.rootNode().attach(&floorNode);
+
+    // Move the instances so that the first one is centered at its grid position
+    graph.update();
+    const Vector3 offset = nodes.front()->pos() - meshes.front()->bounds().center();
+    for (auto node : nodes) {
+        node->translate(offset);
+    }
+
+    auto start = Clock::now();
+    graph.update();
+    world.update();
+    const double sceneMs = msSince(start);
+
+    std::vector<std::uint8_t> buffer(width * height * 3);
+    toy_tracer::Renderer renderer(width, height, options.maxThreads);
+    renderer.setCamera(camera);
+    renderer.setSamples(samples);
+    renderer.setSeed(seed);
+
+    // Primary rays only, paths end at their first hit
+    const std::uint64_t primaryRays = static_cast<std::uint64_t>(width) * height * samples;
+    const std::size_t maxDepth      = world.maxDepth();
+    world.setMaxDepth(1);
+    start = Clock::now();
+    renderer.render(buffer.data(), buffer.size(), world);
+    const double primaryMs = msSince(start);
+    world.setMaxDepth(maxDepth);
+
+    // The number of rays per frame is the same for every thread count, count it once
+    RayCounter counter;
+    world.notifyAdded(&counter);
+    world.update();
+    renderer.render(buffer.data(), buffer.size(), world);
+    world.notifyRemoved(&counter);
+    world.update();
+    const std::uint64_t rays = counter.count();
+
+    std::printf("%s    {\n", first ? "" : ",\n");
+    std::printf("      \"name\": \"%s\",\n", spec.name.c_str());
+    std::printf("      \"triangles\": %zu,\n", spec.geometry->triangleCount());
+    std::printf("      \"geometryBytes\": %zu,\n", spec.geometry->memoryUsage());
+    std::printf("      \"instances\": %d,\n", spec.instances);
+    std::printf("      \"loadMs\": %.3f,\n", spec.loadMs);
+    std::printf("      \"buildMs\": %.3f,\n", spec.geometry->bvhStats().buildTimeMs);
+    std::printf("      \"sceneUpdateMs\": %.3f,\n", sceneMs);
+    std::printf("      \"primaryRays\": %llu,\n", static_cast<unsigned long long>(primaryRays));
+    std::printf("      \"secondaryRays\": %llu,\n", static_cast<unsigned long long>(rays - primaryRays));
+    std::printf("      \"primaryRaysPerSecond\": %.0f,\n", primaryRays / (primaryMs / 1000.0));
+
+    std::vector<std::size_t> threadCounts;
+    for (std::size_t threads = 1; threads < options.maxThreads; threads *= 2) {
+        threadCounts.push_back(threads);
+    }
+    threadCounts.push_back(options.maxThreads);
+
+    double secondaryRaysPerSecond = 0.0;
+    toy_tracer::RenderStats stats;
+    std::printf("      \"threads\": [");
+    for (std::size_t i = 0; i < threadCounts.size(); ++i) {
+        renderer.setThreadCount(threadCounts[i]);
+        start = Clock::now();
+        renderer.render(buffer.data(), buffer.size(), world, &stats);
+        const double renderMs = msSince(start);
+        std::printf("%s\n        { \"count\": %zu, \"renderMs\": %.3f, \"raysPerSecond\": %.0f }", i == 0 ? "" : ",",
+                    threadCounts[i], renderMs, rays / (renderMs / 1000.0));
+        if (threadCounts[i] == options.maxThreads && renderMs > primaryMs) {
+            secondaryRaysPerSecond = (rays - primaryRays) / ((renderMs - primaryMs) / 1000.0);
+        }
+    }
+    std::printf("\n      ],\n");
+    std::printf("      \"secondaryRaysPerSecond\": %.0f%s\n", secondaryRaysPerSecond,
+                toy_tracer::RenderCounters::enabled ? "," : "");
+    if (toy_tracer::RenderCounters::enabled) {
+        printStats(stats);
+    }
+    std::printf("    }");
+    std::fflush(stdout);
+}
+
+SceneSpec loadStl(const std::string& name, toy_tracer::ThreadPool& pool)
+{
+    const auto geometry = std::make_shared<const toy_tracer::MeshGeometry>(
+        toy_tracer::MeshGeometry::fromStlFile(std::string(TOY_TRACER_DATA_DIR) + "/" + name, pool));
+    return { name, geometry, geometry->loadStats().loadTimeMs, 1 };
+}
+
+SceneSpec generateBlob(std::size_t triangles)
+{
+    const auto start    = Clock::now();
+    const auto geometry = std::make_shared<const toy_tracer::MeshGeometry>(makeBlob(triangles));
+    // Generating stands in for loading, the hierarchy build is reported on its own
+    const double loadMs = msSince(start) - geometry->bvhStats().buildTimeMs;
+    return { "blob-" + std::to_string(triangles), geometry, loadMs, 1 };
+}
+} // namespace
+
+int main(int argc, char** argv)
+{
+    Options options;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--max-triangles") == 0 && i + 1 < argc) {
+            options.maxTriangles = std::strtoull(argv[++i], nullptr, 10);
+        } else if (std::strcmp(argv[i], "--max-threads") == 0 && i + 1 < argc) {
+            options.maxThreads = std::max<std::size_t>(1, std::strtoull(argv[++i], nullptr, 10));
+        } else if (std::strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+            options.traceFile = argv[++i];
+        } else {
+            std::fprintf(stderr, "Usage: %s [--max-triangles N] [--max-threads N] [--trace FILE]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (!options.traceFile.empty()) {
+        if (!toy_tracer::TraceRecorder::enabled) {
+            std::fprintf(stderr, "Built without TOY_TRACER_ENABLE_TRACE, the trace will be empty\n");
+        }
+        toy_tracer::TraceRecorder::nameThread("main");
+        toy_tracer::TraceRecorder::start();
+    }
+
+    std::printf("{\n");
+    std::printf("  \"width\": %d,\n", width);
+    std::printf("  \"height\": %d,\n", height);
+    std::printf("  \"samples\": %d,\n", samples);
+    std::printf("  \"seed\": %llu,\n", static_cast<unsigned long long>(seed));
+    std::printf("  \"hardwareThreads\": %u,\n", std::thread::hardware_concurrency());
+    std::printf("  \"scenes\": [\n");
+
+    bool first = true;
+    toy_tracer::ThreadPool loader;
+    benchmark(loadStl("cube.stl", loader), options, first);
+    first = false;
+    SceneSpec monkey = loadStl("monkey.stl", loader);
+    benchmark(monkey, options, first);
+    for (std::size_t triangles = 10000; triangles <= options.maxTriangles; triangles *= 10) {
+        benchmark(generateBlob(triangles), options, first);
+    }
+    monkey.name      = "monkey-instances";
+    monkey.instances = instanceGridWidth * instanceGridWidth;
+    benchmark(monkey, options, first);
+
+    std::printf("\n  ]\n}\n");
+
+    if (!options.traceFile.empty()) {
+        toy_tracer::TraceRecorder::stop();
+        try {
+            toy_tracer::TraceRecorder::writeFile(options.traceFile);
+        } catch (const std::runtime_error& error) {
+            std::fprintf(stderr, "%s\n", error.what());
+            return 1;
+        }
+    }
+    return 0;
+}
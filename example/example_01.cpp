@@ -5,6 +5,8 @@
 #include <toy_tracer/renderer.hpp>
 #include <toy_tracer/scene_node.hpp>
 
+#include <iostream>
+
 using Vector3 = toy_tracer::math::Vector<float, 3>;
 int main(int argc, char** argv)
 {
@@ -13,6 +15,7 @@ int main(int argc, char** argv)
     toy_tracer::Renderer renderer(800, 600);
     toy_tracer::Camera camera(4, 3, 1.0f);
     renderer.setCamera(camera);
+    renderer.setAdaptiveSampling(16, 100, 1.0f);
 
     toy_tracer::SceneGraph graph;
     toy_tracer::World world;
@@ -24,7 +27,11 @@ int main(int argc, char** argv)
     graph.rootNode().attach(&cameraNode);
 
     toy_tracer::SceneNode meshNode("mesh");
-    toy_tracer::Mesh mesh = toy_tracer::Mesh::fromStlFile("../data/monkey.stl");
+    toy_tracer::Mesh mesh = toy_tracer::Mesh::fromStlFile("../data/monkey.stl", "monkey.stl.cache", renderer.threadPool());
+    std::cout << "Loaded " << mesh.loadStats().bytes << " bytes in " << mesh.loadStats().loadTimeMs << " ms ("
+              << mesh.loadStats().megabytesPerSecond() << " MB/s)" << std::endl;
+    std::cout << "BVH: " << mesh.bvhStats().nodeCount << " nodes, " << mesh.bvhStats().leafCount << " leaves, built in "
+              << mesh.bvhStats().buildTimeMs << " ms" << std::endl;
     meshNode.attach(&mesh);
     meshNode.translate(Vector3{ 0.0f, 0.25f, 2.0f });
     meshNode.rotateX(toy_tracer::math::degToRad(80.0f));
@@ -41,7 +48,8 @@ int main(int argc, char** argv)
     graph.rootNode().attach(&floorNode);
 
     std::vector<uint8_t> buffer(800 * 600 * 3);
-    graph.rootNode().update();
+    graph.update(renderer.threadPool());
+    world.update();
     renderer.render(buffer.data(), buffer.size(), world);
 
     // Create SDL2 window, renderer and surface
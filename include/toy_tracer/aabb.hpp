@@ -0,0 +1,76 @@
+#ifndef TOY_TRACER_AABB_HPP
+#define TOY_TRACER_AABB_HPP
+
+#include "math.hpp"
+
+#include <limits>
+
+namespace toy_tracer
+{
+/**
+ * @brief Axis aligned bounding box, empty by default
+ */
+struct Aabb {
+    using Vector3 = math::Vector<float, 3>;
+
+    Vector3 min = { std::numeric_limits<float>::max(), std::numeric_limits<float>::max(),
+                    std::numeric_limits<float>::max() };
+    Vector3 max = { -std::numeric_limits<float>::max(), -std::numeric_limits<float>::max(),
+                    -std::numeric_limits<float>::max() };
+
+    bool isEmpty() const noexcept
+    {
+        return min[0] > max[0] || min[1] > max[1] || min[2] > max[2];
+    }
+
+    void grow(const Vector3& p) noexcept
+    {
+        for (std::size_t i = 0; i < 3; ++i) {
+            min[i] = std::min(min[i], p[i]);
+            max[i] = std::max(max[i], p[i]);
+        }
+    }
+
+    void grow(const Aabb& box) noexcept
+    {
+        for (std::size_t i = 0; i < 3; ++i) {
+            min[i] = std::min(min[i], box.min[i]);
+            max[i] = std::max(max[i], box.max[i]);
+        }
+    }
+
+    Vector3 center() const noexcept
+    {
+        return 0.5f * (min + max);
+    }
+
+    float area() const noexcept
+    {
+        if (isEmpty()) {
+            return 0.0f;
+        }
+        const Vector3 e = max - min;
+        return 2.0f * (e[0] * e[1] + e[1] * e[2] + e[2] * e[0]);
+    }
+
+    /**
+     * @brief Slab test against a ray given by its origin and inverse direction.
+     * On a hit, tNear holds the entry distance (clamped to 0).
+     */
+    bool hit(const Vector3& origin, const Vector3& invDir, float tMax, float& tNear) const noexcept
+    {
+        float t0 = 0.0f;
+        float t1 = tMax;
+        for (std::size_t i = 0; i < 3; ++i) {
+            const float a = (min[i] - origin[i]) * invDir[i];
+            const float b = (max[i] - origin[i]) * invDir[i];
+            t0            = std::max(t0, std::min(a, b));
+            t1            = std::min(t1, std::max(a, b));
+        }
+        tNear = t0;
+        return t0 <= t1;
+    }
+};
+} // namespace toy_tracer
+
+#endif
@@ -0,0 +1,270 @@
+#ifndef TOY_TRACER_BVH_HPP
+#define TOY_TRACER_BVH_HPP
+
+#include "aabb.hpp"
+#include "math.hpp"
+#include "ray.hpp"
+#include "ray_packet.hpp"
+#include "render_stats.hpp"
+
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+namespace toy_tracer
+{
+/**
+ * @brief Bounding volume hierarchy over a set of primitive bounds,
+ * built with a binned surface area heuristic.
+ *
+ * The hierarchy does not own the primitives. build() returns the order in
+ * which the leaves reference them, the owner is expected to either reorder its
+ * primitives accordingly or to keep the order as an index table.
+ *
+ * Primitives can be grouped into fixed size blocks that are intersected as a
+ * whole, every leaf then starts at a block boundary and the order is padded
+ * with invalidIndex.
+ */
+class Bvh {
+    using Vector3 = math::Vector<float, 3>;
+
+  public:
+    /**
+     * @brief Inner nodes have count == 0 and their children at first and first + 1,
+     * leaves reference the primitives [first, first + count) of the build order.
+     */
+    struct Node {
+        Aabb bounds;
+        std::uint32_t first = 0;
+        std::uint32_t count = 0;
+
+        bool isLeaf() const noexcept
+        {
+            return count != 0;
+        }
+    };
+
+    struct Stats {
+        std::size_t nodeCount = 0;
+        std::size_t leafCount = 0;
+        std::size_t maxDepth  = 0;
+        double buildTimeMs    = 0.0;
+    };
+
+    static constexpr std::size_t maxDepth       = 64;
+    static constexpr std::uint32_t invalidIndex = std::numeric_limits<std::uint32_t>::max();
+
+    Bvh() = default;
+
+    /**
+     * @brief (Re)build the hierarchy
+     * @param bounds The bounds of every primitive
+     * @param maxLeafSize Nodes with more primitives are always split
+     * @param blockSize Number of primitives intersected at once
+     * @return The primitive order referenced by the leaves
+     */
+    std::vector<std::uint32_t> build(const std::vector<Aabb>& bounds, std::uint32_t maxLeafSize = 4, std::uint32_t blockSize = 1);
+
+    /**
+     * @brief Take over a hierarchy built before, e.g. loaded from a cache
+     */
+    void assign(std::vector<Node> nodes, const Stats& stats)
+    {
+        nodes_ = std::move(nodes);
+        stats_ = stats;
+        parents_.clear();
+        cost_      = surfaceCost();
+        builtCost_ = relativeCost();
+    }
+
+    /**
+     * @brief Set the bounds of a leaf, e.g. after its primitives moved, and
+     * grow or shrink its ancestors to match. The topology is kept, so the
+     * hierarchy gets worse the further the primitives move.
+     * @param leaf Index of the leaf node
+     * @param bounds The bounds of all primitives of the leaf
+     */
+    void refit(std::uint32_t leaf, const Aabb& bounds);
+
+    /**
+     * @brief Surface area cost of the hierarchy relative to its cost when it
+     * was built, 1 right after build() and larger the more refits degraded it
+     */
+    double degradation() const noexcept
+    {
+        return builtCost_ > 0.0 ? relativeCost() / builtCost_ : 1.0;
+    }
+
+    bool empty() const noexcept
+    {
+        return nodes_.empty();
+    }
+
+    const Aabb& bounds() const noexcept
+    {
+        return nodes_.front().bounds;
+    }
+
+    const std::vector<Node>& nodes() const noexcept
+    {
+        return nodes_;
+    }
+
+    const Stats& stats() const noexcept
+    {
+        return stats_;
+    }
+
+    /**
+     * @brief Visit the leaves hit by the ray front to back
+     * @param visit Called as visit(first, count, tMax) for each leaf that is
+     * closer than tMax, returns the (possibly reduced) tMax or a negative
+     * value to end the traversal
+     */
+    template<typename Visitor>
+    void traverse(const Ray& ray, float tMax, Visitor&& visit) const noexcept
+    {
+        if (nodes_.empty()) {
+            return;
+        }
+        const Vector3& origin = ray.origin();
+        const Vector3& invDir = ray.invDirection();
+
+        struct Entry {
+            std::uint32_t node;
+            float tNear;
+        };
+        Entry stack[maxDepth];
+        std::size_t size = 0;
+
+        float tNear = 0.0f;
+        RenderCounters::countBoxTests(1);
+        if (!nodes_[0].bounds.hit(origin, invDir, tMax, tNear)) {
+            return;
+        }
+        stack[size++] = { 0, tNear };
+        while (size > 0) {
+            const Entry entry = stack[--size];
+            if (entry.tNear > tMax) {
+                continue;
+            }
+            const Node* node = &nodes_[entry.node];
+            while (!node->isLeaf()) {
+                const Node& left  = nodes_[node->first];
+                const Node& right = nodes_[node->first + 1];
+                float tLeft       = 0.0f;
+                float tRight      = 0.0f;
+                const bool hitL   = left.bounds.hit(origin, invDir, tMax, tLeft);
+                const bool hitR   = right.bounds.hit(origin, invDir, tMax, tRight);
+                RenderCounters::countBoxTests(2);
+                if (hitL && hitR) {
+                    if (tLeft <= tRight) {
+                        stack[size++] = { node->first + 1, tRight };
+                        node          = &left;
+                    } else {
+                        stack[size++] = { node->first, tLeft };
+                        node          = &right;
+                    }
+                } else if (hitL) {
+                    node = &left;
+                } else if (hitR) {
+                    node = &right;
+                } else {
+                    node = nullptr;
+                    break;
+                }
+            }
+            if (node) {
+                tMax = visit(node->first, node->count, tMax);
+                if (tMax < 0.0f) {
+                    return;
+                }
+            }
+        }
+    }
+
+    /**
+     * @brief Visit the leaves hit by any ray of the packet.
+     * A node is tested ray by ray until the first ray that hits it, rays before
+     * that one are inactive for the whole subtree.
+     * @param tMax Per ray limit, may be reduced by the visitor
+     * @param visit Called as visit(first, count, firstRay) for each leaf
+     */
+    template<typename Visitor>
+    void traverse(const RayPacket& packet, const float* tMax, Visitor&& visit) const noexcept
+    {
+        if (nodes_.empty() || packet.count == 0) {
+            return;
+        }
+        const Vector3* invDirs = packet.invDirections;
+        auto firstHit = [&](const Node& node, std::size_t first, float& tNear) {
+            const std::size_t begin = first;
+            for (; first < packet.count; ++first) {
+                if (node.bounds.hit(packet.origins[first], invDirs[first], tMax[first], tNear)) {
+                    break;
+                }
+            }
+            RenderCounters::countBoxTests(std::min(first + 1, packet.count) - begin);
+            return first;
+        };
+
+        struct Entry {
+            std::uint32_t node;
+            std::uint32_t firstRay;
+        };
+        Entry stack[maxDepth + 1];
+        std::size_t size = 0;
+        stack[size++]    = { 0, 0 };
+        while (size > 0) {
+            const Entry entry       = stack[--size];
+            const Node& node        = nodes_[entry.node];
+            float tNear             = 0.0f;
+            const std::size_t first = firstHit(node, entry.firstRay, tNear);
+            if (first == packet.count) {
+                continue;
+            }
+            if (node.isLeaf()) {
+                visit(node.first, node.count, first);
+                continue;
+            }
+            // Order the children by the entry distance of the first active ray
+            float tLeft  = 0.0f;
+            float tRight = 0.0f;
+            if (!nodes_[node.first].bounds.hit(packet.origins[first], invDirs[first], tMax[first], tLeft)) {
+                tLeft = std::numeric_limits<float>::max();
+            }
+            if (!nodes_[node.first + 1].bounds.hit(packet.origins[first], invDirs[first], tMax[first], tRight)) {
+                tRight = std::numeric_limits<float>::max();
+            }
+            RenderCounters::countBoxTests(2);
+            const std::uint32_t firstRay = static_cast<std::uint32_t>(first);
+            if (tLeft <= tRight) {
+                stack[size++] = { node.first + 1, firstRay };
+                stack[size++] = { node.first, firstRay };
+            } else {
+                stack[size++] = { node.first, firstRay };
+                stack[size++] = { node.first + 1, firstRay };
+            }
+        }
+    }
+
+  private:
+    /**
+     * @brief Area of every node weighted by its cost, summed
+     */
+    double surfaceCost() const noexcept;
+
+    double relativeCost() const noexcept
+    {
+        return nodes_.empty() || nodes_.front().bounds.area() <= 0.0f ? 0.0 : cost_ / nodes_.front().bounds.area();
+    }
+
+    std::vector<Node> nodes_;
+    std::vector<std::uint32_t> parents_; // built on the first refit
+    Stats stats_;
+    double cost_      = 0.0;
+    double builtCost_ = 0.0;
+};
+} // namespace toy_tracer
+
+#endif
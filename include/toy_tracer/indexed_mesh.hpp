@@ -0,0 +1,75 @@
+#ifndef TOY_TRACER_INDEXED_MESH_HPP
+#define TOY_TRACER_INDEXED_MESH_HPP
+
+#include "math.hpp"
+#include "thread_pool.hpp"
+#include "triangle.hpp"
+
+#include <cstdint>
+#include <vector>
+
+namespace toy_tracer
+{
+/**
+ * @brief Triangles that share a vertex buffer, each triangle is a triple of
+ * 32 bit vertex indices. Every vertex also has a smooth normal, the area
+ * weighted average of the normals of the triangles around it.
+ */
+class IndexedMesh final {
+  public:
+    using Vector3 = math::Vector<float, 3>;
+
+    IndexedMesh() = default;
+
+    /**
+     * @param indices Three indices per triangle
+     */
+    IndexedMesh(std::vector<Vector3> vertices, std::vector<std::uint32_t> indices);
+
+    /**
+     * @brief Build an indexed mesh from a triangle soup, positions with the
+     * same value become one vertex. Vertices are numbered in the order of
+     * their first position.
+     * @param positions Three positions per triangle
+     */
+    static IndexedMesh weld(const std::vector<Vector3>& positions);
+
+    /**
+     * @brief Weld on the workers of the pool, each worker merges the
+     * positions of its share of the hash values. The result is the same as
+     * the one of the serial weld.
+     */
+    static IndexedMesh weld(const std::vector<Vector3>& positions, ThreadPool& pool);
+
+    static IndexedMesh weld(const std::vector<Triangle>& triangles);
+
+    std::size_t triangleCount() const noexcept
+    {
+        return indices_.size() / 3;
+    }
+
+    const std::vector<Vector3>& vertices() const noexcept
+    {
+        return vertices_;
+    }
+
+    const std::vector<std::uint32_t>& indices() const noexcept
+    {
+        return indices_;
+    }
+
+    const std::vector<Vector3>& normals() const noexcept
+    {
+        return normals_;
+    }
+
+  private:
+    void computeNormals();
+
+    std::vector<Vector3> vertices_;
+    std::vector<std::uint32_t> indices_;
+    std::vector<Vector3> normals_;
+};
+} // namespace toy_tracer
+
+#endif
@@ -47,6 +47,12 @@ T dot(const toy_tracer::math::Vector<T, N>& v, const toy_tracer::math::Vector<T,
 template<typename T, std::size_t N>
 toy_tracer::math::Vector<T, N> normalize(const toy_tracer::math::Vector<T, N>& v);
 
+template<typename T>
+T determinant(const toy_tracer::math::Matrix<T, 3, 3>& m);
+
+template<typename T>
+toy_tracer::math::Matrix<T, 3, 3> inverse(const toy_tracer::math::Matrix<T, 3, 3>& m);
+
 } // namespace math
 } // namespace toy_tracer
 
@@ -187,6 +193,28 @@ toy_tracer::math::normalize(const toy_tracer::math::Vector<T, N>& v)
     return v / length(v);
 }
 
+template<typename T>
+T toy_tracer::math::determinant(const toy_tracer::math::Matrix<T, 3, 3>& m)
+{
+    return toy_tracer::math::dot(m[0], toy_tracer::math::cross(m[1], m[2]));
+}
+
+template<typename T>
+toy_tracer::math::Matrix<T, 3, 3>
+toy_tracer::math::inverse(const toy_tracer::math::Matrix<T, 3, 3>& m)
+{
+    // The columns of the inverse are the cross products of the rows divided by the determinant
+    const toy_tracer::math::Vector<T, 3> c0 = toy_tracer::math::cross(m[1], m[2]);
+    const toy_tracer::math::Vector<T, 3> c1 = toy_tracer::math::cross(m[2], m[0]);
+    const toy_tracer::math::Vector<T, 3> c2 = toy_tracer::math::cross(m[0], m[1]);
+    const T d                               = toy_tracer::math::dot(m[0], c0);
+    return toy_tracer::math::Matrix<T, 3, 3>{
+        toy_tracer::math::Vector<T, 3>{ c0[0] / d, c1[0] / d, c2[0] / d },
+        toy_tracer::math::Vector<T, 3>{ c0[1] / d, c1[1] / d, c2[1] / d },
+        toy_tracer::math::Vector<T, 3>{ c0[2] / d, c1[2] / d, c2[2] / d },
+    };
+}
+
 template<typename T, std::size_t N, std::size_t M, std::size_t P>
 toy_tracer::math::Matrix<T, N, P> operator*(const toy_tracer::math::Matrix<T, N, M>& m, const toy_tracer::math::Matrix<T, M, P>& n)
 {
@@ -2,16 +2,23 @@
 #define TOY_TRACER_MESH_HPP
 
 #include "math.hpp"
+#include "mesh_geometry.hpp"
 #include "renderable.hpp"
 #include "scene_node.hpp"
 #include "scene_object.hpp"
 #include "triangle.hpp"
 #include "vertex_map.hpp"
 
-#include <fstream>
+#include <memory>
+#include <string>
 
 namespace toy_tracer
 {
+/**
+ * @brief An instance of a MeshGeometry placed by the node it is attached to.
+ * The geometry is shared, an instance only adds its transform, the inverse
+ * used to map rays into local space and its world space bounds.
+ */
 class Mesh : public SceneObject, public Renderable {
     using Vector3 = math::Vector<float, 3>;
 
@@ -22,7 +29,7 @@ class Mesh : public SceneObject, public Renderable {
 
       public:
         Map()
-                : t_{}
+                : t_{}, invRot_{}, invTranslate_{}, cofactor_{}, det_(0.0f)
         {
         }
 
@@ -31,6 +38,16 @@ class Mesh : public SceneObject, public Renderable {
                       Vector4{ rot[1][0] * scale[0], rot[1][1] * scale[1], rot[1][2] * scale[2], translate[1] },
                       Vector4{ rot[2][0] * scale[0], rot[2][1] * scale[1], rot[2][2] * scale[2], translate[2] } }
         {
+            invRot_       = math::inverse(Matrix3{ Vector3{ t_[0][0], t_[0][1], t_[0][2] },
+                                             Vector3{ t_[1][0], t_[1][1], t_[1][2] },
+                                             Vector3{ t_[2][0], t_[2][1], t_[2][2] } });
+            invTranslate_ = -(invRot_ * translate);
+            det_          = 1.0f / math::determinant(invRot_);
+            for (std::size_t i = 0; i < 3; ++i) {
+                for (std::size_t j = 0; j < 3; ++j) {
+                    cofactor_[i][j] = det_ * invRot_[j][i];
+                }
+            }
         }
 
         Vector3 map(const Vector3& vertex) const noexcept override
@@ -38,105 +55,82 @@ class Mesh : public SceneObject, public Renderable {
             return t_ * Vector4{ vertex[0], vertex[1], vertex[2], 1.0f };
         }
 
-      private:
-        math::Matrix<float, 3, 4> t_;
-    };
-
-    class BoundingSphere {
-      public:
-        using Vector3 = Mesh::Vector3;
-
-        BoundingSphere() = default;
-
-        BoundingSphere(Vector3 min, Vector3 max)
-                : center_(0.5f * (min + max)), radius_(math::length(0.5f * (max - min)))
+        /**
+         * @brief Map a world space ray into the local space of the mesh.
+         * The direction is not normalized, so distances along the ray are the same in both spaces.
+         */
+        Ray toLocal(const Ray& ray) const noexcept
         {
+            return Ray(invRot_ * ray.origin() + invTranslate_, invRot_ * ray.direction());
         }
 
-        std::optional<HitRecord> hit(const Ray& ray, const VertexMap& map) const noexcept
+        /**
+         * @brief Map a local space normal to a normalized world space normal
+         */
+        Vector3 mapNormal(const Vector3& normal) const noexcept
         {
-            const Vector3 center = map.map(center_);
-            const Vector3 p      = map.map(center + radius_ * Vector3{ 1.0f, 0.0f, 0.0f });
-            const float radius   = math::length(p - center);
-            if (math::length(ray.origin() - center) < radius) {
-                return HitRecord{};
-            }
+            return math::normalize(cofactor_ * normal);
+        }
 
-            const Vector3 oc = ray.origin() - center;
-            const auto& dir  = ray.direction();
-            const float a    = math::dot(dir, dir);
-            const float b    = 2.0f * math::dot(oc, dir);
-            const float c    = math::dot(oc, oc) - radius * radius;
-            const float d    = b * b - 4.0f * a * c;
-            if (d < 0.0f) {
-                return std::nullopt;
-            }
-            const float t = (-b - std::sqrt(d)) / (2.0f * a);
-            if (t < 0.0f) {
-                return std::nullopt;
-            }
-            return HitRecord{};
+        float determinant() const noexcept
+        {
+            return det_;
         }
 
       private:
-        Vector3 center_;
-        float radius_;
+        math::Matrix<float, 3, 4> t_;
+        Matrix3 invRot_;
+        Vector3 invTranslate_;
+        Matrix3 cofactor_;
+        float det_;
     };
 
   public:
-    Mesh() = default;
+    Mesh()
+            : Mesh(std::make_shared<const MeshGeometry>())
+    {
+    }
 
     Mesh(std::vector<Triangle> triangles)
-            : triangles_(), vertexMap_(), node_(nullptr)
-    {
-        Vector3 max = { -std::numeric_limits<float>::max(), -std::numeric_limits<float>::max(),
-                        -std::numeric_limits<float>::max() };
-        Vector3 min = { std::numeric_limits<float>::max(), std::numeric_limits<float>::max(),
-                        std::numeric_limits<float>::max() };
-        triangles_.reserve(triangles.size());
-        for (auto& triangle : triangles) {
-            max[0] = std::max(max[0], std::max(triangle.v0()[0], std::max(triangle.v1()[0], triangle.v2()[0])));
-            max[1] = std::max(max[1], std::max(triangle.v0()[1], std::max(triangle.v1()[1], triangle.v2()[1])));
-            max[2] = std::max(max[2], std::max(triangle.v0()[2], std::max(triangle.v1()[2], triangle.v2()[2])));
-            min[0] = std::min(min[0], std::min(triangle.v0()[0], std::min(triangle.v1()[0], triangle.v2()[0])));
-            min[1] = std::min(min[1], std::min(triangle.v0()[1], std::min(triangle.v1()[1], triangle.v2()[1])));
-            min[2] = std::min(min[2], std::min(triangle.v0()[2], std::min(triangle.v1()[2], triangle.v2()[2])));
-            triangles_.emplace_back(triangle);
-        }
-        boundingSphere_ = BoundingSphere(min, max);
+            : Mesh(std::make_shared<const MeshGeometry>(triangles))
+    {
+    }
+
+    /**
+     * @brief Another instance of an existing geometry
+     */
+    explicit Mesh(std::shared_ptr<const MeshGeometry> geometry)
+            : geometry_(std::move(geometry)), vertexMap_(), node_(nullptr)
+    {
     }
 
+    /**
+     * @brief Load a binary STL file, see StlFile::read
+     */
     static Mesh fromStlFile(const std::string& filename)
     {
-        using Vector3 = math::Vector<float, 3>;
-        struct Header {
-            char header[80];
-            uint32_t triangleCount;
-        };
+        return Mesh(std::make_shared<const MeshGeometry>(MeshGeometry::fromStlFile(filename)));
+    }
 
-        std::ifstream file(filename, std::ios::binary);
-        if (!file.is_open()) {
-            throw std::runtime_error("Could not open file " + filename);
-        }
+    /**
+     * @brief Load a binary STL file on the given workers, see MeshGeometry::fromStlFile
+     */
+    static Mesh fromStlFile(const std::string& filename, ThreadPool& pool)
+    {
+        return Mesh(std::make_shared<const MeshGeometry>(MeshGeometry::fromStlFile(filename, pool)));
+    }
 
-        std::vector<Triangle> triangles;
-        Header header;
-        file.read(reinterpret_cast<char*>(&header), sizeof(Header));
-        triangles.resize(header.triangleCount);
-        for (auto& triangle : triangles) {
-            Vector3 normal;
-            Vector3 v0;
-            Vector3 v1;
-            Vector3 v2;
-            uint16_t attributeByteCount;
-            file.read(reinterpret_cast<char*>(&normal), sizeof(Vector3));
-            file.read(reinterpret_cast<char*>(&v0), sizeof(Vector3));
-            file.read(reinterpret_cast<char*>(&v1), sizeof(Vector3));
-            file.read(reinterpret_cast<char*>(&v2), sizeof(Vector3));
-            file.read(reinterpret_cast<char*>(&attributeByteCount), sizeof(uint16_t));
-            triangle = Triangle(v0, v1, v2);
-        }
-        return Mesh(std::move(triangles));
+    /**
+     * @brief Load a binary STL file through a cache, see MeshGeometry::fromStlFile
+     */
+    static Mesh fromStlFile(const std::string& filename, const std::string& cacheFile)
+    {
+        return Mesh(std::make_shared<const MeshGeometry>(MeshGeometry::fromStlFile(filename, cacheFile)));
+    }
+
+    static Mesh fromStlFile(const std::string& filename, const std::string& cacheFile, ThreadPool& pool)
+    {
+        return Mesh(std::make_shared<const MeshGeometry>(MeshGeometry::fromStlFile(filename, cacheFile, pool)));
     }
 
     Mesh(const Mesh&)            = delete;
@@ -147,23 +141,113 @@ class Mesh : public SceneObject, public Renderable {
 
     std::optional<HitRecord> hit(const Ray& ray) const noexcept override
     {
-        if (!boundingSphere_.hit(ray, vertexMap_))
+        float tNear = 0.0f;
+        if (!bounds_.hit(ray.origin(), ray.invDirection(), std::numeric_limits<float>::max(), tNear)) {
             return std::nullopt;
+        }
 
-        std::optional<HitRecord> hitRecord = std::nullopt;
-        for (auto& triangle : triangles_) {
-            if (auto record = triangle.hit(ray, vertexMap_)) {
-                if (!hitRecord || record->distance < hitRecord->distance) {
-                    hitRecord = record;
-                }
+        // Intersect in local space, distances along the local ray match the world ray
+        const Ray localRay   = vertexMap_.toLocal(ray);
+        const float detScale = vertexMap_.determinant();
+        float closest        = std::numeric_limits<float>::max();
+        std::size_t block    = 0;
+        int lane             = -1;
+        if (!geometry_->hit(localRay, detScale, closest, block, lane)) {
+            return std::nullopt;
+        }
+        return record(block, lane, localRay, detScale, closest);
+    }
+
+    bool occluded(const Ray& ray, float tMax) const noexcept override
+    {
+        float tNear = 0.0f;
+        if (!bounds_.hit(ray.origin(), ray.invDirection(), tMax, tNear)) {
+            return false;
+        }
+        return geometry_->occluded(vertexMap_.toLocal(ray), vertexMap_.determinant(), tMax);
+    }
+
+    void hitPacket(const RayPacket& packet, std::optional<HitRecord>* records) const noexcept override
+    {
+        float tMax[RayPacket::size];
+        bool any = false;
+        for (std::size_t i = 0; i < packet.count; ++i) {
+            float tNear = 0.0f;
+            tMax[i]     = records[i] ? records[i]->distance : std::numeric_limits<float>::max();
+            any |= bounds_.hit(packet.origins[i], packet.invDirections[i], tMax[i], tNear);
+        }
+        if (!any) {
+            return;
+        }
+
+        RayPacket localPacket;
+        std::size_t blocks[RayPacket::size];
+        int lanes[RayPacket::size];
+        for (std::size_t i = 0; i < packet.count; ++i) {
+            localPacket.push(vertexMap_.toLocal(packet.ray(i)));
+        }
+        const float detScale = vertexMap_.determinant();
+        geometry_->hitPacket(localPacket, detScale, tMax, blocks, lanes);
+        for (std::size_t i = 0; i < packet.count; ++i) {
+            if (lanes[i] >= 0) {
+                records[i] = record(blocks[i], lanes[i], localPacket.ray(i), detScale, tMax[i]);
             }
         }
-        return hitRecord;
+    }
+
+    Aabb bounds() const noexcept override
+    {
+        return bounds_;
+    }
+
+    const std::shared_ptr<const MeshGeometry>& geometry() const noexcept
+    {
+        return geometry_;
+    }
+
+    /**
+     * @brief Node count and build time of the bounding volume hierarchy of the geometry
+     */
+    const Bvh::Stats& bvhStats() const noexcept
+    {
+        return geometry_->bvhStats();
+    }
+
+    /**
+     * @brief Size and load time of the file the geometry was loaded from
+     */
+    const StlFile::Stats& loadStats() const noexcept
+    {
+        return geometry_->loadStats();
+    }
+
+    /**
+     * @brief Shade with the interpolated vertex normals instead of the face normals
+     */
+    void setSmoothShading(bool enabled) noexcept
+    {
+        smoothShading_ = enabled;
+    }
+
+    bool smoothShading() const noexcept
+    {
+        return smoothShading_;
     }
 
     void notifyNodeUpdated() override
     {
         vertexMap_ = Map(node_->absPos(), node_->absScale(), node_->absRot());
+
+        // World space bounds of the corners of the hull boxes, recomputed only
+        // when the transform changes and tested before a ray is mapped to local space
+        bounds_ = Aabb{};
+        for (const Aabb& local : geometry_->hullBoxes()) {
+            for (int corner = 0; corner < 8; ++corner) {
+                bounds_.grow(vertexMap_.map(Vector3{ (corner & 1) ? local.max[0] : local.min[0],
+                                                     (corner & 2) ? local.max[1] : local.min[1],
+                                                     (corner & 4) ? local.max[2] : local.min[2] }));
+            }
+        }
     }
 
     void notifyAttached(SceneNode* node) override
@@ -176,10 +260,21 @@ class Mesh : public SceneObject, public Renderable {
     }
 
   private:
-    std::vector<Triangle> triangles_;
-    BoundingSphere boundingSphere_;
+    /**
+     * @brief The hit record of a hit of the geometry, in world space
+     */
+    HitRecord record(std::size_t block, int lane, const Ray& localRay, float detScale, float t) const noexcept
+    {
+        HitRecord record = geometry_->record(block, lane, localRay, detScale, t, smoothShading_);
+        record.normal    = vertexMap_.mapNormal(record.normal);
+        return record;
+    }
+
+    std::shared_ptr<const MeshGeometry> geometry_;
     Map vertexMap_;
+    Aabb bounds_;
     SceneNode* node_;
+    bool smoothShading_ = false;
 };
 } // namespace toy_tracer
 
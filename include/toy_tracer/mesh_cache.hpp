@@ -0,0 +1,61 @@
+#ifndef TOY_TRACER_MESH_CACHE_HPP
+#define TOY_TRACER_MESH_CACHE_HPP
+
+#include "bvh.hpp"
+#include "math.hpp"
+#include "stl_file.hpp"
+#include "triangle_block.hpp"
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace toy_tracer
+{
+/**
+ * @brief The processed data of a mesh as stored in a cache file: the welded
+ * vertices, the index blocks and the built hierarchy.
+ *
+ * The file is a fixed header followed by the arrays as they are laid out in
+ * memory, each starting at a 64 byte boundary. It is keyed by a hash of the
+ * source file and carries a version and the sizes of the stored structures,
+ * a cache that does not match any of them is ignored.
+ */
+struct MeshCache {
+    /**
+     * @brief Increased whenever the layout of the file or of the stored structures changes
+     */
+    static constexpr std::uint32_t version = 2;
+
+    std::uint64_t sourceHash = 0;
+    std::vector<math::Vector<float, 3>> vertices;
+    std::vector<math::Vector<float, 3>> normals; // per vertex
+    std::vector<IndexBlock> blocks;
+    std::vector<Bvh::Node> nodes;
+    std::size_t triangleCount = 0;
+    Bvh::Stats bvhStats;
+    StlFile::Stats stats; // of reading the cache
+
+    /**
+     * @brief Map the cache file and copy out its arrays, nothing is parsed
+     * @return Nothing if the file cannot be read, is of another version, was built from another
+     * source or its indices point outside of its arrays, it never throws for a bad cache
+     */
+    static std::optional<MeshCache> read(const std::string& filename, std::uint64_t sourceHash);
+
+    /**
+     * @brief Write the cache, the file is replaced at once so concurrent readers never see half of it
+     * @throws std::runtime_error If the file cannot be written
+     */
+    void write(const std::string& filename) const;
+
+    /**
+     * @brief 64 bit hash of the contents of a file
+     * @throws std::runtime_error If the file cannot be read
+     */
+    static std::uint64_t hashFile(const std::string& filename);
+};
+} // namespace toy_tracer
+
+#endif
@@ -0,0 +1,402 @@
+#ifndef TOY_TRACER_MESH_GEOMETRY_HPP
+#define TOY_TRACER_MESH_GEOMETRY_HPP
+
+#include "bvh.hpp"
+#include "indexed_mesh.hpp"
+#include "math.hpp"
+#include "mesh_cache.hpp"
+#include "ray_packet.hpp"
+#include "render_stats.hpp"
+#include "stl_file.hpp"
+#include "trace_recorder.hpp"
+#include "triangle.hpp"
+#include "triangle_block.hpp"
+
+#include <limits>
+#include <optional>
+#include <stdexcept>
+#include <string>
+
+namespace toy_tracer
+{
+/**
+ * @brief The immutable, local space part of a mesh: the welded vertices, the
+ * triangles as blocks of vertex indices, their intersection blocks and the
+ * hierarchy over them. Any number of Mesh instances can share one geometry,
+ * each with its own transform.
+ *
+ * The index blocks are the compact form that is cached and that smooth
+ * shading reads, the intersection blocks are computed from them once and are
+ * all the traversal reads. The vertices are numbered in the order the blocks
+ * use them.
+ */
+class MeshGeometry final {
+  public:
+    using Vector3 = math::Vector<float, 3>;
+
+  public:
+    MeshGeometry() = default;
+
+    explicit MeshGeometry(const std::vector<Triangle>& triangles)
+    {
+        std::vector<Aabb> bounds(triangles.size());
+        for (std::size_t i = 0; i < triangles.size(); ++i) {
+            bounds[i].grow(triangles[i].v0());
+            bounds[i].grow(triangles[i].v1());
+            bounds[i].grow(triangles[i].v2());
+        }
+        build(IndexedMesh::weld(triangles), bounds);
+    }
+
+    explicit MeshGeometry(StlFile stl)
+            : loadStats_(stl.stats)
+    {
+        build(std::move(stl.mesh), stl.bounds);
+    }
+
+    explicit MeshGeometry(MeshCache cache)
+            : vertices_(std::move(cache.vertices)), normals_(std::move(cache.normals)),
+              indexBlocks_(std::move(cache.blocks)), triangleCount_(cache.triangleCount), loadStats_(cache.stats)
+    {
+        bvh_.assign(std::move(cache.nodes), cache.bvhStats);
+        unpackBlocks();
+        collectHullBoxes();
+    }
+
+    MeshGeometry(const MeshGeometry&)            = delete;
+    MeshGeometry(MeshGeometry&&)                 = default;
+    MeshGeometry& operator=(const MeshGeometry&) = delete;
+    MeshGeometry& operator=(MeshGeometry&&)      = default;
+
+    /**
+     * @brief Load a binary STL file, see StlFile::read
+     * @param pool Workers that parse the file, e.g. Renderer::threadPool, so
+     * loading many files does not start threads for each of them
+     */
+    static MeshGeometry fromStlFile(const std::string& filename, ThreadPool& pool)
+    {
+        TraceScope scope("MeshGeometry::fromStlFile");
+        return MeshGeometry(StlFile::read(filename, pool));
+    }
+
+    /**
+     * @brief Load a binary STL file on a pool of its own
+     */
+    static MeshGeometry fromStlFile(const std::string& filename)
+    {
+        ThreadPool pool;
+        return fromStlFile(filename, pool);
+    }
+
+    /**
+     * @brief Load a binary STL file through a cache of the processed mesh,
+     * the cache is written if it is missing or was built from another file
+     * @param cacheFile Where to keep the cache, e.g. next to the STL file
+     * @param pool Workers that parse the file if the cache cannot be used
+     */
+    static MeshGeometry fromStlFile(const std::string& filename, const std::string& cacheFile, ThreadPool& pool)
+    {
+        TraceScope scope("MeshGeometry::fromStlFile cached");
+        return fromStlFile(filename, cacheFile, MeshCache::hashFile(filename), &pool);
+    }
+
+    /**
+     * @brief Load a binary STL file through a cache, the pool is only started
+     * if the cache cannot be used
+     */
+    static MeshGeometry fromStlFile(const std::string& filename, const std::string& cacheFile)
+    {
+        TraceScope scope("MeshGeometry::fromStlFile cached");
+        return fromStlFile(filename, cacheFile, MeshCache::hashFile(filename), nullptr);
+    }
+
+    /**
+     * @brief The processed data of the mesh for a cache file
+     * @param sourceHash Hash of the file the mesh was loaded from, see MeshCache::hashFile
+     */
+    MeshCache cache(std::uint64_t sourceHash) const
+    {
+        MeshCache cache;
+        cache.sourceHash    = sourceHash;
+        cache.vertices      = vertices_;
+        cache.normals       = normals_;
+        cache.blocks        = indexBlocks_;
+        cache.nodes         = bvh_.nodes();
+        cache.triangleCount = triangleCount_;
+        cache.bvhStats      = bvh_.stats();
+        return cache;
+    }
+
+    /**
+     * @brief Find the closest hit of a local space ray
+     * @param detScale Determinant of the transform to world space, see TriangleBlock::intersect
+     * @param tMax Only hits closer than tMax are reported, updated on a hit
+     * @param block, lane Receive the location of the hit for record()
+     */
+    bool hit(const Ray& ray, float detScale, float& tMax, std::size_t& block, int& lane) const noexcept
+    {
+        bool found = false;
+        bvh_.traverse(ray, tMax, [&](std::uint32_t first, std::uint32_t count, float limit) {
+            // Leaves start at a block boundary and are padded to whole blocks
+            const std::size_t begin = first / TriangleBlock::width;
+            const std::size_t end   = (first + count + TriangleBlock::width - 1) / TriangleBlock::width;
+            std::size_t hitBlock    = 0;
+            const int hitLane       = intersectBlocks(&blocks_[begin], end - begin, ray, detScale, limit, hitBlock);
+            RenderCounters::countTriangleTests((end - begin) * TriangleBlock::width);
+            if (hitLane >= 0) {
+                block = begin + hitBlock;
+                lane  = hitLane;
+                found = true;
+            }
+            tMax = limit;
+            return limit;
+        });
+        return found;
+    }
+
+    /**
+     * @brief Whether a local space ray hits anything closer than tMax, the
+     * first leaf with a hit ends the traversal
+     */
+    bool occluded(const Ray& ray, float detScale, float tMax) const noexcept
+    {
+        bool occluded = false;
+        bvh_.traverse(ray, tMax, [&](std::uint32_t first, std::uint32_t count, float limit) {
+            const std::size_t begin = first / TriangleBlock::width;
+            const std::size_t end   = (first + count + TriangleBlock::width - 1) / TriangleBlock::width;
+            std::size_t block       = 0;
+            RenderCounters::countTriangleTests((end - begin) * TriangleBlock::width);
+            if (intersectBlocks(&blocks_[begin], end - begin, ray, detScale, limit, block) >= 0) {
+                occluded = true;
+                return -1.0f;
+            }
+            return limit;
+        });
+        return occluded;
+    }
+
+    /**
+     * @brief Find the closest hits of a packet of local space rays, see hit()
+     * @param lanes Set to -1 for rays without a hit closer than their tMax
+     */
+    void hitPacket(const RayPacket& packet, float detScale, float* tMax, std::size_t* blocks, int* lanes) const noexcept
+    {
+        std::fill(lanes, lanes + packet.count, -1);
+
+        // Each block of a leaf is tested against all active rays while it is in cache
+        bvh_.traverse(packet, tMax, [&](std::uint32_t first, std::uint32_t count, std::size_t firstRay) {
+            const std::size_t begin = first / TriangleBlock::width;
+            const std::size_t end   = (first + count + TriangleBlock::width - 1) / TriangleBlock::width;
+            RenderCounters::countTriangleTests((end - begin) * TriangleBlock::width * (packet.count - firstRay));
+            for (std::size_t i = firstRay; i < packet.count; ++i) {
+                std::size_t block = 0;
+                const int lane    = intersectBlocks(&blocks_[begin], end - begin, packet.ray(i), detScale, tMax[i], block);
+                if (lane >= 0) {
+                    blocks[i] = begin + block;
+                    lanes[i]  = lane;
+                }
+            }
+        });
+    }
+
+    /**
+     * @brief The hit record of a hit found by hit() or hitPacket(), the normal is in local space
+     * @param smooth Use the interpolated vertex normal instead of the face normal
+     */
+    HitRecord record(std::size_t block, int lane, const Ray& ray, float detScale, float t, bool smooth) const noexcept
+    {
+        HitRecord record = blocks_[block].record(static_cast<std::size_t>(lane), ray, detScale, t);
+        if (smooth) {
+            const Vector3 normal = smoothNormal(indexBlocks_[block], static_cast<std::size_t>(lane), ray.at(t));
+            // Keep the smooth normal on the side of the face
+            if (math::dot(normal, record.normal) > 0.0f) {
+                record.normal = math::normalize(normal);
+            }
+        }
+        return record;
+    }
+
+    /**
+     * @brief Local space bounds of all triangles
+     */
+    Aabb bounds() const noexcept
+    {
+        return bvh_.empty() ? Aabb{} : bvh_.bounds();
+    }
+
+    /**
+     * @brief Local space boxes that together enclose all triangles, the nodes
+     * of the hierarchy at hullDepth. Their transformed corners bound an
+     * instance more tightly than the corners of the root box.
+     */
+    const std::vector<Aabb>& hullBoxes() const noexcept
+    {
+        return hullBoxes_;
+    }
+
+    /**
+     * @brief Node count and build time of the bounding volume hierarchy
+     */
+    const Bvh::Stats& bvhStats() const noexcept
+    {
+        return bvh_.stats();
+    }
+
+    /**
+     * @brief Size and load time of the file the geometry was loaded from, empty otherwise
+     */
+    const StlFile::Stats& loadStats() const noexcept
+    {
+        return loadStats_;
+    }
+
+    std::size_t triangleCount() const noexcept
+    {
+        return triangleCount_;
+    }
+
+    std::size_t vertexCount() const noexcept
+    {
+        return vertices_.size();
+    }
+
+    /**
+     * @brief Bytes of the vertices, normals, index and intersection blocks and hierarchy nodes
+     */
+    std::size_t memoryUsage() const noexcept
+    {
+        return vertices_.capacity() * sizeof(Vector3) + normals_.capacity() * sizeof(Vector3)
+               + indexBlocks_.capacity() * sizeof(IndexBlock) + blocks_.capacity() * sizeof(TriangleBlock)
+               + bvh_.nodes().capacity() * sizeof(Bvh::Node);
+    }
+
+  private:
+    static constexpr std::size_t hullDepth = 3;
+
+    /**
+     * @param sourceHash Hash of the STL file, the file is only read again if the cache does not match it
+     * @param pool Workers that parse the file, a pool of its own is started if there are none
+     */
+    static MeshGeometry fromStlFile(const std::string& filename, const std::string& cacheFile,
+                                    std::uint64_t sourceHash, ThreadPool* pool)
+    {
+        if (auto cache = MeshCache::read(cacheFile, sourceHash)) {
+            return MeshGeometry(std::move(*cache));
+        }
+        std::optional<ThreadPool> ownPool;
+        if (!pool) {
+            pool = &ownPool.emplace();
+        }
+        MeshGeometry geometry = fromStlFile(filename, *pool);
+        try {
+            geometry.cache(sourceHash).write(cacheFile);
+        } catch (const std::runtime_error&) {
+            // The cache only speeds up the next start, the mesh is fine without it
+        }
+        return geometry;
+    }
+
+    void build(IndexedMesh mesh, const std::vector<Aabb>& bounds)
+    {
+        const std::vector<std::uint32_t> triangleIds = bvh_.build(bounds, IndexBlock::width, IndexBlock::width);
+        triangleCount_                               = mesh.triangleCount();
+
+        // Renumber the vertices in the order of their first use by a block lane
+        std::vector<std::uint32_t> numbers(mesh.vertices().size(), Bvh::invalidIndex);
+        vertices_.clear();
+        normals_.clear();
+        vertices_.reserve(mesh.vertices().size());
+        normals_.reserve(mesh.vertices().size());
+        indexBlocks_.resize(triangleIds.size() / IndexBlock::width);
+        for (std::size_t i = 0; i < triangleIds.size(); ++i) {
+            IndexBlock& block      = indexBlocks_[i / IndexBlock::width];
+            const std::size_t lane = i % IndexBlock::width;
+            const std::uint32_t id = triangleIds[i];
+            for (std::size_t k = 0; k < 3; ++k) {
+                if (id == Bvh::invalidIndex) {
+                    block.index[k][lane] = 0;
+                    continue;
+                }
+                const std::uint32_t vertex = mesh.indices()[3 * id + k];
+                if (numbers[vertex] == Bvh::invalidIndex) {
+                    numbers[vertex] = static_cast<std::uint32_t>(vertices_.size());
+                    vertices_.push_back(mesh.vertices()[vertex]);
+                    normals_.push_back(mesh.normals()[vertex]);
+                }
+                block.index[k][lane] = numbers[vertex];
+            }
+        }
+        unpackBlocks();
+        collectHullBoxes();
+    }
+
+    void unpackBlocks()
+    {
+        blocks_.resize(indexBlocks_.size());
+        for (std::size_t i = 0; i < indexBlocks_.size(); ++i) {
+            indexBlocks_[i].unpack(vertices_.data(), blocks_[i]);
+        }
+    }
+
+    /**
+     * @brief Interpolated vertex normal at point p of a triangle, not normalized
+     */
+    Vector3 smoothNormal(const IndexBlock& block, std::size_t lane, const Vector3& p) const noexcept
+    {
+        const Vector3& v0 = vertices_[block.index[0][lane]];
+        const Vector3 e0  = vertices_[block.index[1][lane]] - v0;
+        const Vector3 e1  = vertices_[block.index[2][lane]] - v0;
+        const Vector3 d   = p - v0;
+
+        // Barycentric coordinates of p, u weights the second and v the third vertex
+        const float d00   = math::dot(e0, e0);
+        const float d01   = math::dot(e0, e1);
+        const float d11   = math::dot(e1, e1);
+        const float d20   = math::dot(d, e0);
+        const float d21   = math::dot(d, e1);
+        const float denom = d00 * d11 - d01 * d01;
+        if (denom == 0.0f) {
+            return math::cross(e0, e1);
+        }
+        const float u = (d11 * d20 - d01 * d21) / denom;
+        const float v = (d00 * d21 - d01 * d20) / denom;
+        return (1.0f - u - v) * normals_[block.index[0][lane]] + u * normals_[block.index[1][lane]]
+               + v * normals_[block.index[2][lane]];
+    }
+
+    void collectHullBoxes()
+    {
+        hullBoxes_.clear();
+        if (bvh_.empty()) {
+            return;
+        }
+        struct Entry {
+            std::uint32_t node;
+            std::size_t depth;
+        };
+        std::vector<Entry> stack = { { 0, 0 } };
+        while (!stack.empty()) {
+            const Entry entry     = stack.back();
+            const Bvh::Node& node = bvh_.nodes()[entry.node];
+            stack.pop_back();
+            if (node.isLeaf() || entry.depth == hullDepth) {
+                hullBoxes_.push_back(node.bounds);
+            } else {
+                stack.push_back({ node.first, entry.depth + 1 });
+                stack.push_back({ node.first + 1, entry.depth + 1 });
+            }
+        }
+    }
+
+    std::vector<Vector3> vertices_;
+    std::vector<Vector3> normals_; // smooth normal of each vertex
+    std::vector<IndexBlock> indexBlocks_;
+    std::vector<TriangleBlock> blocks_; // computed from indexBlocks_
+    std::size_t triangleCount_ = 0;
+    Bvh bvh_;
+    std::vector<Aabb> hullBoxes_;
+    StlFile::Stats loadStats_;
+};
+} // namespace toy_tracer
+
+#endif
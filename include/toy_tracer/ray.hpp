@@ -8,7 +8,17 @@ namespace toy_tracer
 class Ray {
   public:
     Ray(const math::Vector<float, 3>& origin, const math::Vector<float, 3>& direction)
-            : origin_(origin), direction_(direction)
+            : origin_(origin), direction_(direction),
+              invDirection_{ 1.0f / direction[0], 1.0f / direction[1], 1.0f / direction[2] }
+    {
+    }
+
+    /**
+     * @brief Construct a ray whose inverse direction is already known
+     */
+    Ray(const math::Vector<float, 3>& origin, const math::Vector<float, 3>& direction,
+        const math::Vector<float, 3>& invDirection)
+            : origin_(origin), direction_(direction), invDirection_(invDirection)
     {
     }
 
@@ -22,6 +32,14 @@ class Ray {
         return direction_;
     }
 
+    /**
+     * @brief Componentwise reciprocal of the direction, for slab tests against boxes
+     */
+    const math::Vector<float, 3>& invDirection() const
+    {
+        return invDirection_;
+    }
+
     math::Vector<float, 3> at(float t) const
     {
         return origin_ + t * direction_;
@@ -30,6 +48,7 @@ class Ray {
   private:
     math::Vector<float, 3> origin_;
     math::Vector<float, 3> direction_;
+    math::Vector<float, 3> invDirection_;
 };
 } // namespace toy_tracer
 
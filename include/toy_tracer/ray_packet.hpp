@@ -0,0 +1,40 @@
+#ifndef TOY_TRACER_RAY_PACKET_HPP
+#define TOY_TRACER_RAY_PACKET_HPP
+
+#include "math.hpp"
+#include "ray.hpp"
+
+#include <cstddef>
+
+namespace toy_tracer
+{
+/**
+ * @brief A bundle of coherent rays, e.g. the primary rays of a 4x4 pixel block,
+ * that are traced through the acceleration structures together
+ */
+struct RayPacket {
+    using Vector3 = math::Vector<float, 3>;
+
+    static constexpr std::size_t size = 16;
+
+    Vector3 origins[size];
+    Vector3 directions[size];
+    Vector3 invDirections[size];
+    std::size_t count = 0;
+
+    void push(const Ray& ray) noexcept
+    {
+        origins[count]       = ray.origin();
+        directions[count]    = ray.direction();
+        invDirections[count] = ray.invDirection();
+        ++count;
+    }
+
+    Ray ray(std::size_t i) const noexcept
+    {
+        return Ray(origins[i], directions[i], invDirections[i]);
+    }
+};
+} // namespace toy_tracer
+
+#endif
@@ -0,0 +1,134 @@
+#ifndef TOY_TRACER_RENDER_STATS_HPP
+#define TOY_TRACER_RENDER_STATS_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace toy_tracer
+{
+/**
+ * @brief Counters of the work done while rendering.
+ *
+ * Every render thread counts into its own instance, found through a thread
+ * local pointer, and the instances are summed once the frame is done. Unless
+ * TOY_TRACER_ENABLE_STATS is defined the count functions are empty and the
+ * counters are never touched.
+ */
+struct alignas(64) RenderCounters {
+#ifdef TOY_TRACER_ENABLE_STATS
+    static constexpr bool enabled = true;
+#else
+    static constexpr bool enabled = false;
+#endif
+
+    /**
+     * @brief Rays are counted by the number of bounces before them, the last
+     * depth also counts all deeper rays
+     */
+    static constexpr std::size_t depthCount = 16;
+
+    std::uint64_t rays[depthCount] = {};
+    std::uint64_t hits[depthCount] = {};
+    std::uint64_t boxTests         = 0; // ray against hierarchy node
+    std::uint64_t triangleTests    = 0; // ray against triangle, padding lanes included
+
+    std::uint64_t totalRays() const noexcept
+    {
+        std::uint64_t total = 0;
+        for (auto count : rays) {
+            total += count;
+        }
+        return total;
+    }
+
+    std::uint64_t totalHits() const noexcept
+    {
+        std::uint64_t total = 0;
+        for (auto count : hits) {
+            total += count;
+        }
+        return total;
+    }
+
+    /**
+     * @brief Share of the rays that hit anything
+     */
+    double hitRatio() const noexcept
+    {
+        const std::uint64_t rayCount = totalRays();
+        return rayCount == 0 ? 0.0 : static_cast<double>(totalHits()) / static_cast<double>(rayCount);
+    }
+
+    void merge(const RenderCounters& other) noexcept
+    {
+        for (std::size_t i = 0; i < depthCount; ++i) {
+            rays[i] += other.rays[i];
+            hits[i] += other.hits[i];
+        }
+        boxTests += other.boxTests;
+        triangleTests += other.triangleTests;
+    }
+
+#ifdef TOY_TRACER_ENABLE_STATS
+    /**
+     * @brief Counters of the calling thread, null outside of a render
+     */
+    static inline thread_local RenderCounters* current = nullptr;
+#endif
+
+    static void countRay(std::size_t depth, bool hit) noexcept
+    {
+#ifdef TOY_TRACER_ENABLE_STATS
+        if (current) {
+            depth = std::min(depth, depthCount - 1);
+            ++current->rays[depth];
+            current->hits[depth] += hit;
+        }
+#else
+        (void)depth;
+        (void)hit;
+#endif
+    }
+
+    static void countBoxTests(std::uint64_t count) noexcept
+    {
+#ifdef TOY_TRACER_ENABLE_STATS
+        if (current) {
+            current->boxTests += count;
+        }
+#else
+        (void)count;
+#endif
+    }
+
+    static void countTriangleTests(std::uint64_t count) noexcept
+    {
+#ifdef TOY_TRACER_ENABLE_STATS
+        if (current) {
+            current->triangleTests += count;
+        }
+#else
+        (void)count;
+#endif
+    }
+};
+
+/**
+ * @brief Statistics of one render or accumulate call
+ */
+struct RenderStats {
+    struct Thread {
+        double busyMs     = 0.0; // rendering tiles
+        double idleMs     = 0.0; // waiting for the other threads to finish
+        std::size_t tiles = 0;
+    };
+
+    RenderCounters counters;
+    std::vector<Thread> threads;
+    double wallMs = 0.0;
+};
+} // namespace toy_tracer
+
+#endif
@@ -1,8 +1,10 @@
 #ifndef TOY_TRACER_RENDERABLE_HPP
 #define TOY_TRACER_RENDERABLE_HPP
 
+#include "aabb.hpp"
 #include "hit_record.hpp"
 #include "ray.hpp"
+#include "ray_packet.hpp"
 
 #include <optional>
 
@@ -13,6 +15,33 @@ class Renderable {
   public:
     virtual ~Renderable()                                               = default;
     virtual std::optional<HitRecord> hit(const Ray& ray) const noexcept = 0;
+    /**
+     * @brief Intersect all rays of a packet
+     * @param records Closest hit so far per ray, only replaced by closer hits
+     */
+    virtual void hitPacket(const RayPacket& packet, std::optional<HitRecord>* records) const noexcept
+    {
+        for (std::size_t i = 0; i < packet.count; ++i) {
+            if (auto record = hit(packet.ray(i))) {
+                if (!records[i] || record->distance < records[i]->distance) {
+                    records[i] = record;
+                }
+            }
+        }
+    }
+    /**
+     * @brief Whether the ray hits anything closer than tMax, same hits as hit()
+     * but without looking for the closest one or building a record
+     */
+    virtual bool occluded(const Ray& ray, float tMax) const noexcept
+    {
+        auto record = hit(ray);
+        return record && record->distance < tMax;
+    }
+    /**
+     * @brief World space bounds, used by the acceleration structure of the World
+     */
+    virtual Aabb bounds() const noexcept = 0;
     /**
     virtual std::size_t triangleCount() const noexcept                                                                                            = 0;
     virtual const Triangle* triangleAt(std::size_t index) const noexcept                                                                          = 0;
@@ -3,10 +3,16 @@
 
 #include "camera.hpp"
 #include "ray.hpp"
+#include "render_stats.hpp"
 #include "renderable.hpp"
 #include "scene_node.hpp"
+#include "thread_pool.hpp"
 #include "world.hpp"
 
+#include <cassert>
+#include <cstdint>
+#include <functional>
+#include <memory>
 #include <vector>
 
 namespace toy_tracer
@@ -14,9 +20,37 @@ namespace toy_tracer
 class Renderer final {
   public:
     ~Renderer() = default;
-    Renderer(int width, int height)
-            : width_(width), height_(height), camera_(nullptr)
+
+    /**
+     * @param threadCount Number of render threads, 0 for one per hardware thread
+     * @param pinThreads Pin the render threads to CPUs
+     */
+    Renderer(int width, int height, std::size_t threadCount = 0, bool pinThreads = false)
+            : width_(width), height_(height), camera_(nullptr), packetTracing_(false), wavefrontTracing_(false),
+              raySorting_(false), seed_(0), minSamples_(100), maxSamples_(100), errorThreshold_(0.0f),
+              pool_(std::make_unique<ThreadPool>(threadCount, pinThreads)), accumulatedSamples_(0)
+    {
+    }
+
+    /**
+     * @brief Replace the render threads, they are kept alive across render calls
+     */
+    void setThreadCount(std::size_t threadCount, bool pinThreads = false)
+    {
+        pool_ = std::make_unique<ThreadPool>(threadCount, pinThreads);
+    }
+
+    std::size_t threadCount() const noexcept
     {
+        return pool_->size();
+    }
+
+    /**
+     * @brief The render threads, e.g. to update the scene graph between frames
+     */
+    ThreadPool& threadPool() noexcept
+    {
+        return *pool_;
     }
 
     void setCamera(const Camera& camera) noexcept
@@ -24,15 +58,147 @@ class Renderer final {
         camera_ = &camera;
     }
 
+    /**
+     * @brief Trace the primary rays of 4x4 pixel blocks as packets
+     */
+    void setPacketTracing(bool enabled) noexcept
+    {
+        packetTracing_ = enabled;
+    }
+
+    bool packetTracing() const noexcept
+    {
+        return packetTracing_;
+    }
+
+    /**
+     * @brief Trace the samples of a tile as one batch, bounce by bounce, instead
+     * of one path after another. Takes precedence over packet tracing.
+     */
+    void setWavefrontTracing(bool enabled) noexcept
+    {
+        wavefrontTracing_ = enabled;
+    }
+
+    bool wavefrontTracing() const noexcept
+    {
+        return wavefrontTracing_;
+    }
+
+    /**
+     * @brief Sort the rays of a wavefront batch by direction and origin before
+     * every bounce, so neighbouring rays traverse the same nodes
+     */
+    void setRaySorting(bool enabled) noexcept
+    {
+        raySorting_ = enabled;
+    }
+
+    bool raySorting() const noexcept
+    {
+        return raySorting_;
+    }
+
+    /**
+     * @brief Seed of the per pixel and sample random numbers, renders with the
+     * same seed are identical regardless of the thread count
+     */
+    void setSeed(std::uint64_t seed) noexcept
+    {
+        seed_ = seed;
+    }
+
+    /**
+     * @brief Trace the same number of samples for every pixel in render
+     */
+    void setSamples(int samples) noexcept
+    {
+        setAdaptiveSampling(samples, samples, 0.0f);
+    }
+
+    /**
+     * @brief Stop sampling a pixel in render once the standard error of its
+     * mean brightness drops below errorThreshold (in 8-bit color steps), every
+     * pixel gets at least minSamples and at most maxSamples samples
+     */
+    void setAdaptiveSampling(int minSamples, int maxSamples, float errorThreshold) noexcept
+    {
+        assert(minSamples > 0 && minSamples <= maxSamples);
+        minSamples_     = minSamples;
+        maxSamples_     = maxSamples;
+        errorThreshold_ = errorThreshold;
+    }
+
+    int minSamples() const noexcept
+    {
+        return minSamples_;
+    }
+
+    int maxSamples() const noexcept
+    {
+        return maxSamples_;
+    }
+
+    float errorThreshold() const noexcept
+    {
+        return errorThreshold_;
+    }
+
     /**
      * @brief Render the scene to the given buffer
+     * @param stats Receives the statistics of the frame, only if the library
+     * is built with TOY_TRACER_ENABLE_STATS
+     */
+    void render(void* buffer, size_t size, const World& world, RenderStats* stats = nullptr) const noexcept;
+
+    /**
+     * @brief Trace another batch of samples per pixel and add them to the
+     * accumulation buffer, the samples continue the sequence of the previous
+     * calls so n calls with one sample match a render with n samples
+     * @param stats See render()
+     */
+    void accumulate(const World& world, int samples, RenderStats* stats = nullptr);
+
+    /**
+     * @brief Write the average of the samples accumulated so far to the given buffer
+     */
+    void resolve(void* buffer, size_t size) const noexcept;
+
+    /**
+     * @brief Drop the accumulated samples, needed after the scene or the camera changed
      */
-    void render(void* buffer, size_t size, const World& world) const noexcept;
+    void resetAccumulation() noexcept;
+
+    int accumulatedSamples() const noexcept
+    {
+        return accumulatedSamples_;
+    }
 
   private:
+    using PixelSink = std::function<void(int w, int h, const World::ColorVector& sum, int samples)>;
+
+    /**
+     * @brief Trace the samples of every pixel starting at firstSample and hand
+     * their sum and count to store, see setAdaptiveSampling for the limits
+     */
+    void trace(const World& world, int firstSample, int minSamples, int maxSamples, float errorThreshold,
+               const PixelSink& store, RenderStats* stats) const;
+
+    void writePixel(void* buffer, size_t size, int w, int h, const World::ColorVector& color) const noexcept;
+
     int width_;
     int height_;
     const Camera* camera_;
+    bool packetTracing_;
+    bool wavefrontTracing_;
+    bool raySorting_;
+    std::uint64_t seed_;
+    int minSamples_;
+    int maxSamples_;
+    float errorThreshold_;
+    std::unique_ptr<ThreadPool> pool_;
+    std::vector<float> accumulation_;
+    int accumulatedSamples_;
     std::vector<Renderable*> renderables_;
 };
 } // namespace toy_tracer
@@ -0,0 +1,75 @@
+#ifndef TOY_TRACER_SAMPLER_HPP
+#define TOY_TRACER_SAMPLER_HPP
+
+#include "math.hpp"
+
+#include <cstdint>
+
+namespace toy_tracer
+{
+/**
+ * @brief Random numbers for one path, a PCG32 generator whose state is derived
+ * from the pixel and sample index. Every path owns its sampler, so results do
+ * not depend on which thread traces it.
+ */
+class Sampler final {
+  public:
+    using Vector3 = math::Vector<float, 3>;
+
+    Sampler() noexcept
+            : Sampler(0, 0, 0)
+    {
+    }
+
+    Sampler(std::uint32_t x, std::uint32_t y, std::uint32_t sample, std::uint64_t seed = 0) noexcept
+            : state_(0), inc_((mix(seed ^ sample) << 1) | 1u)
+    {
+        state_ = mix((static_cast<std::uint64_t>(y) << 32 | x) + mix(seed + sample));
+        nextUint();
+    }
+
+    std::uint32_t nextUint() noexcept
+    {
+        const std::uint64_t old = state_;
+        state_                  = old * 6364136223846793005ull + inc_;
+        const auto xorshifted   = static_cast<std::uint32_t>(((old >> 18u) ^ old) >> 27u);
+        const auto rot          = static_cast<std::uint32_t>(old >> 59u);
+        return (xorshifted >> rot) | (xorshifted << ((32u - rot) & 31u));
+    }
+
+    /**
+     * @brief Uniform float in [0, 1)
+     */
+    float next() noexcept
+    {
+        return static_cast<float>(nextUint() >> 8) * (1.0f / 16777216.0f);
+    }
+
+    /**
+     * @brief Uniform point inside the unit sphere
+     */
+    Vector3 unitSphere() noexcept
+    {
+        Vector3 p;
+        do {
+            p = Vector3{ 2.0f * next() - 1.0f, 2.0f * next() - 1.0f, 2.0f * next() - 1.0f };
+        } while (math::length(p) >= 1.0f);
+        return p;
+    }
+
+  private:
+    // SplitMix64 finalizer, spreads neighbouring pixel and sample indices over the state space
+    static std::uint64_t mix(std::uint64_t z) noexcept
+    {
+        z += 0x9e3779b97f4a7c15ull;
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+        return z ^ (z >> 31);
+    }
+
+    std::uint64_t state_;
+    std::uint64_t inc_;
+};
+} // namespace toy_tracer
+
+#endif
@@ -3,8 +3,9 @@
 #include "math.hpp"
 #include "scene_object.hpp"
 
+#include <cstdint>
+#include <deque>
 #include <functional>
-#include <list>
 #include <string>
 #include <string_view>
 #include <vector>
@@ -13,6 +14,7 @@ namespace toy_tracer
 {
 class SceneNode;
 class SceneGraph;
+class ThreadPool;
 
 class SceneNode final {
     using Vector3 = math::Vector<float, 3>;
@@ -60,14 +62,25 @@ class SceneNode final {
     void detach(SceneObject* obj);
     void attach(SceneNode* node);
     void detach(SceneNode* node);
+
+    /**
+     * @brief Bring the transforms below this node up to date and notify the
+     * attached objects. Nodes of a graph are updated with the whole graph,
+     * see SceneGraph::update().
+     */
     void update();
 
   private:
     friend class SceneGraph;
+    static constexpr std::uint32_t invalidIndex = UINT32_MAX;
+
     SceneNode(SceneGraph* graph, std::string_view id) noexcept;
     void notifyAttached(SceneNode* parent);
     void notifyDetached();
-    void notifyNeedsUpdate(UpdateType type = UpdateType::pos | UpdateType::childNodes);
+    void notifyNeedsUpdate(UpdateType type = UpdateType::pos);
+    void updateTransform();
+    void updateObjects();
+    void notifyObjects();
 
     void setGraph(SceneGraph* graph);
     void unsetGraph();
@@ -77,6 +90,9 @@ class SceneNode final {
     SceneNode* parent_       = nullptr;
     SceneGraph* graph_       = nullptr;
     UpdateType neededUpdate_ = UpdateType::none;
+    std::uint32_t index_     = invalidIndex; // position in the order of the graph
+    SceneGraph* owner_       = nullptr;      // graph whose pool holds the node, see SceneGraph::createNode
+    bool isFree_             = false;        // returned to the pool of the owner
 
     Vector3 pos_    = { { 0.0, 0.0, 0.0 } };
     Vector3 scale_  = { { 1.0, 1.0, 1.0 } };
@@ -90,8 +106,8 @@ class SceneNode final {
     bool absIsFlipped_ = false;
     bool absIsVisible_ = true;
 
-    std::list<SceneNode*> childNodes_;
-    std::list<SceneObject*> sceneObjects_;
+    std::vector<SceneNode*> childNodes_;
+    std::vector<SceneObject*> sceneObjects_;
 };
 
 class SceneGraphObserver {
@@ -99,20 +115,97 @@ class SceneGraphObserver {
     virtual ~SceneGraphObserver()                 = default;
     virtual void notifyAdded(SceneObject* node)   = 0;
     virtual void notifyRemoved(SceneObject* node) = 0;
+    virtual void notifyUpdated(SceneObject* node) = 0;
 };
 
+/**
+ * @brief Tree of scene nodes below a root node.
+ *
+ * The graph keeps its nodes in depth first order, so the subtree of a node is
+ * the range of nodes that follows it, and a list of the nodes changed since
+ * the last update. update() walks the subtree ranges of the changed nodes
+ * front to back, a parent always comes before its children. The order is
+ * only recomputed after nodes were attached or detached.
+ *
+ * The transforms stay in the nodes rather than in arrays of the graph: the
+ * attached objects read them from their node while it is updated, so the
+ * node is visited either way, and separate arrays made the update slower
+ * for nodes with objects.
+ */
 class SceneGraph final {
   public:
     SceneGraph() noexcept;
+    SceneGraph(const SceneGraph&) = delete;
+    SceneGraph& operator=(const SceneGraph&) = delete;
+
     void notifyAdded(SceneObject* node);
     void notifyRemoved(SceneObject* node);
+    void notifyUpdated(SceneObject* node);
     void addObserver(SceneGraphObserver* observer);
     void rmObserver(SceneGraphObserver* observer);
     SceneNode& rootNode() { return root_; }
 
+    /**
+     * @brief Bring the transforms of all changed nodes and of their subtrees
+     * up to date and notify the attached objects and the observers
+     */
+    void update();
+
+    /**
+     * @brief Like update(), large subtrees are split into independent ranges
+     * that the workers of the pool update concurrently. The objects of
+     * different nodes update their derived data at the same time, the
+     * observers are notified afterwards on the calling thread.
+     */
+    void update(ThreadPool& pool);
+
+    /**
+     * @brief A node allocated from the pool of the graph, it is not attached
+     * and stays valid until it is destroyed or the graph is destructed
+     */
+    SceneNode* createNode(std::string_view id = "Node");
+
+    /**
+     * @brief Detach a node created by createNode() from its parent and its
+     * children and objects from it, and return it to the pool. Other nodes,
+     * the root node among them, must not be passed.
+     */
+    void destroyNode(SceneNode* node);
+
   private:
+    friend class SceneNode;
+
+    struct Range {
+        std::uint32_t first;
+        std::uint32_t end;
+    };
+
+    /**
+     * @brief Order the changed nodes, notify the objects of the nodes that
+     * only had objects attached or detached
+     * @return The subtree ranges of the moved nodes, front to back
+     */
+    std::vector<Range> changedRanges();
+
+    /**
+     * @brief Update the nodes of the ranges front to back on the calling thread
+     */
+    void update(const std::vector<Range>& ranges);
+    void notifyNeedsUpdate(SceneNode* node);
+    void notifyNoUpdate(SceneNode* node);
+    void notifyStructureChanged() { sorted_ = false; }
+    void sort();
+
     SceneNode root_;
     std::vector<SceneGraphObserver*> observers_;
+
+    std::vector<SceneNode*> nodes_;   // depth first order
+    std::vector<std::uint32_t> ends_; // end of the subtree of each node in nodes_
+    std::vector<SceneNode*> changed_;
+    bool sorted_ = false;
+
+    std::deque<SceneNode> pool_;
+    std::vector<SceneNode*> freeNodes_;
 };
 } // namespace toy_tracer
 #endif
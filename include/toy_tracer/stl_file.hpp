@@ -0,0 +1,43 @@
+#ifndef TOY_TRACER_STL_FILE_HPP
+#define TOY_TRACER_STL_FILE_HPP
+
+#include "aabb.hpp"
+#include "indexed_mesh.hpp"
+#include "thread_pool.hpp"
+
+#include <string>
+#include <vector>
+
+namespace toy_tracer
+{
+/**
+ * @brief The welded triangles of a binary STL file together with their bounds
+ */
+struct StlFile {
+    struct Stats {
+        std::size_t bytes = 0;
+        double loadTimeMs = 0.0;
+
+        double megabytesPerSecond() const noexcept
+        {
+            return loadTimeMs > 0.0 ? static_cast<double>(bytes) / (loadTimeMs * 1000.0) : 0.0;
+        }
+    };
+
+    IndexedMesh mesh;
+    std::vector<Aabb> bounds; // per triangle
+    Aabb meshBounds;
+    Stats stats;
+
+    /**
+     * @brief Map the file into memory and parse the triangle records in one
+     * chunk per worker of the pool, the bounds are computed in the same pass.
+     * Equal positions are welded into one vertex afterwards, on the same pool.
+     * @throws std::runtime_error If the file cannot be read or its size does
+     * not match the triangle count of the header
+     */
+    static StlFile read(const std::string& filename, ThreadPool& pool);
+};
+} // namespace toy_tracer
+
+#endif
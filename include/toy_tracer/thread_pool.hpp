@@ -0,0 +1,62 @@
+#ifndef TOY_TRACER_THREAD_POOL_HPP
+#define TOY_TRACER_THREAD_POOL_HPP
+
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace toy_tracer
+{
+/**
+ * @brief A fixed set of worker threads that live as long as the pool and
+ * run one job at a time, every worker calls the job once
+ */
+class ThreadPool final {
+  public:
+    /**
+     * @param threadCount Number of workers, 0 for one per hardware thread
+     * @param pinThreads Pin worker i to CPU i (best effort, Linux only)
+     */
+    explicit ThreadPool(std::size_t threadCount = 0, bool pinThreads = false);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&)            = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    std::size_t size() const noexcept
+    {
+        return threads_.size();
+    }
+
+    bool pinned() const noexcept
+    {
+        return pinned_;
+    }
+
+    /**
+     * @brief Call job(worker) on every worker and wait until all returned.
+     * Concurrent calls are serialized.
+     */
+    void run(const std::function<void(std::size_t)>& job);
+
+  private:
+    void work(std::size_t worker);
+
+    std::vector<std::thread> threads_;
+    bool pinned_;
+
+    std::mutex runMutex_;
+    std::mutex mutex_;
+    std::condition_variable start_;
+    std::condition_variable done_;
+    const std::function<void(std::size_t)>* job_ = nullptr;
+    std::size_t generation_                      = 0;
+    std::size_t remaining_                       = 0;
+    bool stop_                                   = false;
+};
+} // namespace toy_tracer
+
+#endif
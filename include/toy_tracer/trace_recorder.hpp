@@ -0,0 +1,135 @@
+#ifndef TOY_TRACER_TRACE_RECORDER_HPP
+#define TOY_TRACER_TRACE_RECORDER_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+namespace toy_tracer
+{
+/**
+ * @brief Timeline of what every thread did, written as Chrome trace events
+ * for chrome://tracing or Perfetto.
+ *
+ * Each thread records into its own ring buffer, created when the thread
+ * records its first event. Only that thread writes to it, without locks, and
+ * the oldest events are overwritten once it holds capacity events. Unless
+ * TOY_TRACER_ENABLE_TRACE is defined TraceScope is empty and nothing is ever
+ * recorded.
+ */
+class TraceRecorder final {
+  public:
+#ifdef TOY_TRACER_ENABLE_TRACE
+    static constexpr bool enabled = true;
+#else
+    static constexpr bool enabled = false;
+#endif
+
+    /**
+     * @brief Events kept per thread, older events are dropped
+     */
+    static constexpr std::size_t capacity = 1 << 15;
+
+    /**
+     * @brief Record the events of all threads from now on
+     */
+    static void start() noexcept
+    {
+        recording_.store(true, std::memory_order_relaxed);
+    }
+
+    static void stop() noexcept
+    {
+        recording_.store(false, std::memory_order_relaxed);
+    }
+
+    static bool recording() noexcept
+    {
+        return recording_.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Nanoseconds since the first call
+     */
+    static std::uint64_t now() noexcept;
+
+    /**
+     * @brief Record a span of the calling thread
+     * @param name Must outlive the recorder, e.g. a string literal
+     * @param x,y Optional arguments of the event, e.g. the corner of a tile, negative for none
+     */
+    static void record(const char* name, std::uint64_t begin, std::uint64_t end, std::int32_t x = -1,
+                       std::int32_t y = -1) noexcept;
+
+    /**
+     * @brief Name the calling thread in the trace, unnamed threads are called "thread <n>"
+     */
+    static void nameThread(const std::string& name);
+
+    /**
+     * @brief Drop the events recorded so far. No traced code may run at the same time.
+     */
+    static void clear() noexcept;
+
+    /**
+     * @brief Write the recorded events as Chrome trace JSON. No traced code
+     * may run at the same time, e.g. call it between frames.
+     */
+    static void write(std::ostream& out);
+
+    /**
+     * @throws std::runtime_error If the file cannot be written
+     */
+    static void writeFile(const std::string& filename);
+
+  private:
+    static inline std::atomic<bool> recording_{ false };
+};
+
+/**
+ * @brief Records the lifetime of the scope as a span of the calling thread
+ * while the recorder is recording
+ */
+class TraceScope final {
+  public:
+    explicit TraceScope(const char* name, std::int32_t x = -1, std::int32_t y = -1) noexcept
+#ifdef TOY_TRACER_ENABLE_TRACE
+            : name_(name), x_(x), y_(y), begin_(0), active_(TraceRecorder::recording())
+    {
+        if (active_) {
+            begin_ = TraceRecorder::now();
+        }
+    }
+#else
+    {
+        (void)name;
+        (void)x;
+        (void)y;
+    }
+#endif
+
+    ~TraceScope()
+    {
+#ifdef TOY_TRACER_ENABLE_TRACE
+        if (active_) {
+            TraceRecorder::record(name_, begin_, TraceRecorder::now(), x_, y_);
+        }
+#endif
+    }
+
+    TraceScope(const TraceScope&)            = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+
+#ifdef TOY_TRACER_ENABLE_TRACE
+  private:
+    const char* name_;
+    std::int32_t x_;
+    std::int32_t y_;
+    std::uint64_t begin_;
+    bool active_;
+#endif
+};
+} // namespace toy_tracer
+
+#endif
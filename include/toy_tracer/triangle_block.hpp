@@ -0,0 +1,172 @@
+#ifndef TOY_TRACER_TRIANGLE_BLOCK_HPP
+#define TOY_TRACER_TRIANGLE_BLOCK_HPP
+
+#include "hit_record.hpp"
+#include "math.hpp"
+#include "ray.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+
+namespace toy_tracer
+{
+/**
+ * @brief Precomputed intersection data of up to width triangles, stored as
+ * structure of arrays so a block can be streamed lane by lane.
+ *
+ * Unused lanes have a zero normal, their determinant is 0 so they never hit.
+ */
+struct alignas(32) TriangleBlock {
+    using Vector3 = math::Vector<float, 3>;
+
+    static constexpr std::size_t width = 8;
+
+    float v0[3][width];
+    float e0[3][width];
+    float e1[3][width];
+    float n[3][width]; // unnormalized geometric normal cross(e0, e1)
+
+    Vector3 normal(std::size_t lane) const noexcept
+    {
+        return Vector3{ n[0][lane], n[1][lane], n[2][lane] };
+    }
+
+    /**
+     * @brief Find the closest hit in the block
+     * @param ray The ray in the space of the vertices
+     * @param detScale Determinant of the transform to world space, a triangle
+     * only hits when det * detScale is positive, so culling follows the
+     * world space orientation of mirrored instances
+     * @param tMax Only hits closer than tMax are reported, updated on a hit
+     * @return The lane of the closest hit or -1
+     */
+    int intersect(const Ray& ray, float detScale, float& tMax) const noexcept
+    {
+        const Vector3& D = ray.direction();
+        const Vector3& O = ray.origin();
+
+        // All lanes are tested without branches so the loop can be vectorized
+        float tHit[width];
+        for (std::size_t lane = 0; lane < width; ++lane) {
+            // Solve (O - v0) = (e0, e1, -D) * (u, v, t) using Cramer's rule,
+            // with the triple products rewritten around the precomputed normal
+            const float det    = -(n[0][lane] * D[0] + n[1][lane] * D[1] + n[2][lane] * D[2]);
+            const float invDet = 1.0f / det;
+            const float y0     = O[0] - v0[0][lane];
+            const float y1     = O[1] - v0[1][lane];
+            const float y2     = O[2] - v0[2][lane];
+            const float c0     = y1 * D[2] - y2 * D[1];
+            const float c1     = y2 * D[0] - y0 * D[2];
+            const float c2     = y0 * D[1] - y1 * D[0];
+            const float t      = (n[0][lane] * y0 + n[1][lane] * y1 + n[2][lane] * y2) * invDet;
+            const float u      = (e1[0][lane] * c0 + e1[1][lane] * c1 + e1[2][lane] * c2) * invDet;
+            const float v      = -(e0[0][lane] * c0 + e0[1][lane] * c1 + e0[2][lane] * c2) * invDet;
+            const bool valid   = (det * detScale >= std::numeric_limits<float>::epsilon())
+                               & (u >= 0) & (v >= 0) & (u + v <= 1) & (t >= 0) & (t < tMax);
+            tHit[lane]         = valid ? t : std::numeric_limits<float>::infinity();
+        }
+
+        int hitLane = -1;
+        for (std::size_t lane = 0; lane < width; ++lane) {
+            if (tHit[lane] < tMax) {
+                tMax    = tHit[lane];
+                hitLane = static_cast<int>(lane);
+            }
+        }
+        return hitLane;
+    }
+
+    /**
+     * @brief Build the hit record of a lane found by intersect(), the normal is in vertex space
+     * and the shade is scaled by detScale like the culling in intersect()
+     */
+    HitRecord record(std::size_t lane, const Ray& ray, float detScale, float t) const noexcept
+    {
+        const Vector3 normal = this->normal(lane);
+        const float shade    = -math::dot(normal, ray.direction()) * detScale;
+        HitRecord record;
+        record.distance = t;
+        record.rgb      = Vector3{ 50.0, 50.0, 50.0 } + Vector3{ 100.0, 100.0, 100.0 } * shade;
+        record.normal   = math::normalize(normal);
+        return record;
+    }
+};
+
+/**
+ * @brief Vertex indices of up to TriangleBlock::width triangles, the compact
+ * form in which a mesh is cached, 12 bytes per triangle next to the shared
+ * vertices. The TriangleBlocks the traversal tests are unpacked from it once
+ * when the mesh is built or loaded.
+ *
+ * Padding lanes repeat one vertex, they unpack to triangles without area
+ * that never hit.
+ */
+struct IndexBlock {
+    using Vector3 = math::Vector<float, 3>;
+
+    static constexpr std::size_t width = TriangleBlock::width;
+
+    std::uint32_t index[3][width];
+
+    /**
+     * @brief Compute the intersection data of the triangles: the first vertex, the edges to the
+     * other two and their cross product as the normal
+     */
+    void unpack(const Vector3* vertices, TriangleBlock& block) const noexcept
+    {
+        for (std::size_t lane = 0; lane < width; ++lane) {
+            const Vector3& v0 = vertices[index[0][lane]];
+            const Vector3& v1 = vertices[index[1][lane]];
+            const Vector3& v2 = vertices[index[2][lane]];
+            for (std::size_t i = 0; i < 3; ++i) {
+                block.v0[i][lane] = v0[i];
+                block.e0[i][lane] = v1[i] - v0[i];
+                block.e1[i][lane] = v2[i] - v0[i];
+            }
+        }
+        // Lane by lane like math::cross, so the loop is vectorized
+        for (std::size_t lane = 0; lane < width; ++lane) {
+            block.n[0][lane] = block.e0[1][lane] * block.e1[2][lane] - block.e0[2][lane] * block.e1[1][lane];
+            block.n[1][lane] = block.e0[2][lane] * block.e1[0][lane] - block.e0[0][lane] * block.e1[2][lane];
+            block.n[2][lane] = block.e0[0][lane] * block.e1[1][lane] - block.e0[1][lane] * block.e1[0][lane];
+        }
+    }
+};
+
+/**
+ * @brief Instruction sets of the block intersection kernels
+ */
+enum class SimdLevel {
+    scalar,
+    sse,
+    avx2,
+};
+
+/**
+ * @brief The widest kernel the CPU supports
+ */
+SimdLevel supportedSimdLevel() noexcept;
+
+/**
+ * @brief The kernel used by intersectBlocks(), by default supportedSimdLevel()
+ */
+SimdLevel simdLevel() noexcept;
+
+/**
+ * @brief Select the kernel used by intersectBlocks(), e.g. to compare against the scalar path.
+ * Levels the CPU does not support are lowered. Must not be called while rendering.
+ * @return The selected level
+ */
+SimdLevel setSimdLevel(SimdLevel level) noexcept;
+
+/**
+ * @brief Find the closest hit in count consecutive blocks with the selected kernel
+ * @param block Receives the index of the hit block, relative to blocks
+ * @return The lane of the closest hit or -1, see TriangleBlock::intersect
+ */
+int intersectBlocks(const TriangleBlock* blocks, std::size_t count, const Ray& ray, float detScale, float& tMax,
+                    std::size_t& block) noexcept;
+} // namespace toy_tracer
+
+#endif
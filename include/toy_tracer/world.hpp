@@ -1,27 +1,20 @@
 #ifndef TOY_TRACER_WORLD_HPP
 #define TOY_TRACER_WORLD_HPP
 
+#include "bvh.hpp"
 #include "ray.hpp"
+#include "render_stats.hpp"
 #include "renderable.hpp"
+#include "sampler.hpp"
 #include "scene_node.hpp"
 
-#include <random>
+#include <algorithm>
+#include <cassert>
+#include <unordered_map>
 
 namespace toy_tracer
 {
 
-inline math::Vector<float, 3> random_unit() noexcept
-{
-    static std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
-    static std::mt19937 gen;
-    using Vector3 = math::Vector<float, 3>;
-    Vector3 p;
-    do {
-        p = Vector3{ dist(gen), dist(gen), dist(gen) };
-    } while (math::length(p) >= 1.0f);
-    return p;
-}
-
 class World : public SceneGraphObserver {
   public:
     using ColorVector = math::Vector<float, 3>;
@@ -32,6 +25,8 @@ class World : public SceneGraphObserver {
     {
         if (auto renderable = dynamic_cast<Renderable*>(node)) {
             renderables_.push_back(renderable);
+            dirty_   = true;
+            rebuild_ = true;
         }
     }
 
@@ -41,47 +36,300 @@ class World : public SceneGraphObserver {
             auto it = std::find(renderables_.begin(), renderables_.end(), renderable);
             if (it != renderables_.end()) {
                 renderables_.erase(it);
+                dirty_   = true;
+                rebuild_ = true;
+            }
+        }
+    }
+
+    void notifyUpdated(SceneObject* node) override
+    {
+        if (auto renderable = dynamic_cast<Renderable*>(node)) {
+            dirty_ = true;
+            if (!rebuild_) {
+                moved_.push_back(renderable);
+                // Past this many refits a rebuild is cheaper anyway
+                rebuild_ = moved_.size() > renderables_.size();
             }
         }
     }
 
+    /**
+     * @brief Bring the acceleration structure over the world space bounds of
+     * the renderables up to date. Must be called after the scene graph was
+     * updated and before rendering, until then every renderable is tested
+     * for every ray.
+     *
+     * If renderables were only moved, the leaves holding them and their
+     * ancestors are refit. The hierarchy is rebuilt if renderables were added
+     * or removed or if refitting made it worse than the rebuild threshold.
+     */
+    void update()
+    {
+        if (!dirty_) {
+            return;
+        }
+        if (!rebuild_) {
+            for (const Renderable* renderable : moved_) {
+                const auto slot = slots_.find(renderable);
+                if (slot == slots_.end()) {
+                    // Updated but never added, e.g. the world observes a graph that already had nodes
+                    rebuild_ = true;
+                    break;
+                }
+                const std::uint32_t index = slot->second;
+                const Bvh::Node& leaf     = bvh_.nodes()[leaves_[index]];
+                Aabb bounds;
+                for (std::uint32_t i = leaf.first; i < leaf.first + leaf.count; ++i) {
+                    bounds.grow(ordered_[i]->bounds());
+                }
+                bvh_.refit(leaves_[index], bounds);
+            }
+            rebuild_ = rebuild_ || bvh_.degradation() > rebuildThreshold_;
+        }
+        if (rebuild_) {
+            rebuild();
+        }
+        moved_.clear();
+        dirty_   = false;
+        rebuild_ = false;
+    }
+
+    /**
+     * @brief Ratio of the surface area cost of the refit hierarchy to its cost
+     * when it was built above which update() rebuilds it
+     */
+    void setRebuildThreshold(double threshold) noexcept
+    {
+        assert(threshold >= 1.0);
+        rebuildThreshold_ = threshold;
+    }
+
+    double rebuildThreshold() const noexcept
+    {
+        return rebuildThreshold_;
+    }
+
     std::optional<HitRecord>
     hit_renderables(const toy_tracer::Ray& ray) const noexcept
     {
         std::optional<HitRecord> hitRecord = std::nullopt;
-        for (const auto& renderable : renderables_) {
-            if (auto record = renderable->hit(ray)) {
-                if (!hitRecord || record->distance < hitRecord->distance) {
-                    hitRecord = record;
+        if (dirty_) {
+            for (const auto& renderable : renderables_) {
+                if (auto record = renderable->hit(ray)) {
+                    if (!hitRecord || record->distance < hitRecord->distance) {
+                        hitRecord = record;
+                    }
                 }
             }
+            return hitRecord;
         }
+
+        bvh_.traverse(ray, std::numeric_limits<float>::max(), [&](std::uint32_t first, std::uint32_t count, float tMax) {
+            for (std::uint32_t i = first; i < first + count; ++i) {
+                if (auto record = ordered_[i]->hit(ray)) {
+                    if (record->distance < tMax) {
+                        tMax      = record->distance;
+                        hitRecord = record;
+                    }
+                }
+            }
+            return tMax;
+        });
         return hitRecord;
     }
 
-    ColorVector
-    recursive_hit(const toy_tracer::Ray& ray, std::size_t depth = 30) const noexcept
+    /**
+     * @brief Whether any renderable is hit closer than tMax, returns on the
+     * first hit found, e.g. for shadow rays
+     */
+    bool occluded(const Ray& ray, float tMax) const noexcept
     {
-        using Vector3 = math::Vector<float, 3>;
-        if (depth == 0) {
-            return { 0.0f, 0.0f, 0.0f };
+        if (dirty_) {
+            return std::any_of(renderables_.begin(), renderables_.end(), [&](const Renderable* renderable) {
+                return renderable->occluded(ray, tMax);
+            });
         }
 
-        if (auto hitRecord = hit_renderables(ray)) {
-            Vector3 target = ray.at(hitRecord->distance) + math::normalize(hitRecord->normal) + random_unit();
-            Ray newRay(ray.at(hitRecord->distance), target - ray.at(hitRecord->distance));
-            return 0.6f * recursive_hit(newRay, depth - 1);
+        bool occluded = false;
+        bvh_.traverse(ray, tMax, [&](std::uint32_t first, std::uint32_t count, float limit) {
+            for (std::uint32_t i = first; i < first + count; ++i) {
+                if (ordered_[i]->occluded(ray, limit)) {
+                    occluded = true;
+                    return -1.0f;
+                }
+            }
+            return limit;
+        });
+        return occluded;
+    }
+
+    /**
+     * @brief Intersect the rays of a packet with the renderables
+     * @param records Receives the closest hit per ray
+     */
+    void hit_renderables(const RayPacket& packet, std::optional<HitRecord>* records) const noexcept
+    {
+        if (dirty_) {
+            for (const auto& renderable : renderables_) {
+                renderable->hitPacket(packet, records);
+            }
+            return;
         }
-        return { 255.0f, 255.0f, 255.0f };
+
+        float tMax[RayPacket::size];
+        std::fill(tMax, tMax + packet.count, std::numeric_limits<float>::max());
+        bvh_.traverse(packet, tMax, [&](std::uint32_t first, std::uint32_t count, std::size_t firstRay) {
+            for (std::uint32_t i = first; i < first + count; ++i) {
+                ordered_[i]->hitPacket(packet, records);
+            }
+            for (std::size_t i = firstRay; i < packet.count; ++i) {
+                if (records[i]) {
+                    tMax[i] = records[i]->distance;
+                }
+            }
+        });
     }
 
-    ColorVector hit(const Ray& ray) const noexcept
+    /**
+     * @brief Maximum number of rays per path, paths that are still bouncing
+     * after that many intersections are black
+     */
+    void setMaxDepth(std::size_t depth) noexcept
     {
-        return recursive_hit(ray);
+        assert(depth > 0);
+        maxDepth_ = depth;
+    }
+
+    std::size_t maxDepth() const noexcept
+    {
+        return maxDepth_;
+    }
+
+    /**
+     * @brief Depth from which on paths are ended by Russian roulette, they
+     * survive with the probability of their throughput
+     */
+    void setRouletteDepth(std::size_t depth) noexcept
+    {
+        rouletteDepth_ = depth;
+    }
+
+    std::size_t rouletteDepth() const noexcept
+    {
+        return rouletteDepth_;
+    }
+
+    ColorVector hit(const Ray& ray, Sampler& sampler) const noexcept
+    {
+        std::optional<HitRecord> hitRecord = hit_renderables(ray);
+        RenderCounters::countRay(0, hitRecord.has_value());
+        return shade(ray, hitRecord, sampler);
+    }
+
+    /**
+     * @brief Trace the rays of a packet together up to their first hit,
+     * the bounces are traced ray by ray
+     * @param samplers One sampler per ray
+     */
+    void hit(const RayPacket& packet, Sampler* samplers, ColorVector* colors) const noexcept
+    {
+        std::optional<HitRecord> records[RayPacket::size];
+        hit_renderables(packet, records);
+        for (std::size_t i = 0; i < packet.count; ++i) {
+            RenderCounters::countRay(0, records[i].has_value());
+            colors[i] = shade(packet.ray(i), records[i], samplers[i]);
+        }
+    }
+
+    /**
+     * @brief One bounce of a path, used by shade() and by the wavefront renderer
+     * @param ray The ray that produced the hit, replaced by the bounced ray
+     * @param depth Number of rays traced for the path so far
+     * @param throughput Path throughput, updated
+     * @return False if the path ends here, its contribution is black
+     */
+    bool scatter(Ray& ray, const HitRecord& hitRecord, std::size_t depth, float& throughput, Sampler& sampler) const noexcept
+    {
+        using Vector3      = math::Vector<float, 3>;
+        const float albedo = 0.6f;
+        if (depth >= maxDepth_) {
+            return false;
+        }
+        throughput *= albedo;
+        if (depth >= rouletteDepth_) {
+            float survival = std::min(throughput, 1.0f);
+            if (sampler.next() >= survival) {
+                return false;
+            }
+            throughput /= survival;
+        }
+        Vector3 p      = ray.at(hitRecord.distance);
+        Vector3 target = p + math::normalize(hitRecord.normal) + sampler.unitSphere();
+        ray            = Ray(p, target - p);
+        return true;
+    }
+
+    /**
+     * @brief Contribution of a path that leaves the scene
+     */
+    ColorVector background(float throughput) const noexcept
+    {
+        return throughput * ColorVector{ 255.0f, 255.0f, 255.0f };
     }
 
   private:
+    void rebuild()
+    {
+        std::vector<Aabb> bounds;
+        bounds.reserve(renderables_.size());
+        for (const auto& renderable : renderables_) {
+            bounds.push_back(renderable->bounds());
+        }
+        const auto order = bvh_.build(bounds, 2);
+        ordered_.clear();
+        ordered_.reserve(order.size());
+        slots_.clear();
+        for (auto index : order) {
+            slots_[renderables_[index]] = static_cast<std::uint32_t>(ordered_.size());
+            ordered_.push_back(renderables_[index]);
+        }
+        leaves_.assign(ordered_.size(), 0);
+        for (std::uint32_t i = 0; i < bvh_.nodes().size(); ++i) {
+            const Bvh::Node& node = bvh_.nodes()[i];
+            if (node.isLeaf()) {
+                std::fill(leaves_.begin() + node.first, leaves_.begin() + node.first + node.count, i);
+            }
+        }
+    }
+
+    /**
+     * @brief Follow the path that starts with the given ray and its first hit
+     */
+    ColorVector shade(Ray ray, std::optional<HitRecord> hitRecord, Sampler& sampler) const noexcept
+    {
+        float throughput = 1.0f;
+        for (std::size_t depth = 1; hitRecord; ++depth) {
+            if (!scatter(ray, *hitRecord, depth, throughput, sampler)) {
+                return { 0.0f, 0.0f, 0.0f };
+            }
+            hitRecord = hit_renderables(ray);
+            RenderCounters::countRay(depth, hitRecord.has_value());
+        }
+        return background(throughput);
+    }
+
     std::vector<Renderable*> renderables_;
+    std::vector<Renderable*> ordered_;
+    std::unordered_map<const Renderable*, std::uint32_t> slots_; // index into ordered_
+    std::vector<std::uint32_t> leaves_;                           // leaf of each of ordered_
+    std::vector<const Renderable*> moved_;
+    Bvh bvh_;
+    bool dirty_                = false;
+    bool rebuild_              = false;
+    double rebuildThreshold_   = 1.3;
+    std::size_t maxDepth_      = 30;
+    std::size_t rouletteDepth_ = 3;
 };
 } // namespace toy_tracer
 
@@ -0,0 +1,241 @@
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <numeric>
+#include <toy_tracer/bvh.hpp>
+
+using toy_tracer::Aabb;
+using toy_tracer::Bvh;
+using Vector3 = toy_tracer::math::Vector<float, 3>;
+
+namespace
+{
+constexpr std::size_t binCount = 16;
+constexpr float traversalCost  = 1.0f;
+constexpr float intersectCost  = 1.0f;
+
+bool equal(const Aabb& a, const Aabb& b) noexcept
+{
+    for (std::size_t i = 0; i < 3; ++i) {
+        if (a.min[i] != b.min[i] || a.max[i] != b.max[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+struct Split {
+    int axis   = -1;
+    float pos  = 0.0f;
+    float cost = std::numeric_limits<float>::max();
+};
+
+struct Builder {
+    const std::vector<Aabb>& bounds;
+    std::vector<Vector3> centers;
+    std::vector<std::uint32_t>& order;
+    std::vector<Bvh::Node>& nodes;
+    std::uint32_t maxLeafSize;
+    std::uint32_t blockSize;
+    Bvh::Stats& stats;
+
+    float blocks(std::uint32_t count) const
+    {
+        return static_cast<float>((count + blockSize - 1) / blockSize);
+    }
+
+    Split findSplit(const Bvh::Node& node, const Aabb& centerBounds) const
+    {
+        Split best;
+        for (int axis = 0; axis < 3; ++axis) {
+            const float lo = centerBounds.min[axis];
+            const float hi = centerBounds.max[axis];
+            if (hi <= lo) {
+                continue;
+            }
+            Aabb binBounds[binCount];
+            std::uint32_t binCounts[binCount] = {};
+            const float scale                 = static_cast<float>(binCount) / (hi - lo);
+            for (std::uint32_t i = node.first; i < node.first + node.count; ++i) {
+                const std::uint32_t prim = order[i];
+                const std::size_t bin    = std::min(binCount - 1, static_cast<std::size_t>((centers[prim][axis] - lo) * scale));
+                binBounds[bin].grow(bounds[prim]);
+                ++binCounts[bin];
+            }
+
+            // Sweep from both sides to get the cost of every bin plane
+            float leftArea[binCount - 1];
+            std::uint32_t leftCount[binCount - 1];
+            Aabb box;
+            std::uint32_t count = 0;
+            for (std::size_t i = 0; i < binCount - 1; ++i) {
+                box.grow(binBounds[i]);
+                count += binCounts[i];
+                leftArea[i]  = box.area();
+                leftCount[i] = count;
+            }
+            box   = Aabb{};
+            count = 0;
+            for (std::size_t i = binCount - 1; i > 0; --i) {
+                box.grow(binBounds[i]);
+                count += binCounts[i];
+                const float cost = leftArea[i - 1] * blocks(leftCount[i - 1]) + box.area() * blocks(count);
+                if (leftCount[i - 1] != 0 && count != 0 && cost < best.cost) {
+                    best.axis = axis;
+                    best.pos  = lo + static_cast<float>(i) / scale;
+                    best.cost = cost;
+                }
+            }
+        }
+        if (best.axis >= 0) {
+            best.cost = traversalCost + intersectCost * best.cost / node.bounds.area();
+        }
+        return best;
+    }
+
+    void subdivide(std::uint32_t index, std::size_t depth)
+    {
+        stats.maxDepth = std::max(stats.maxDepth, depth);
+
+        Bvh::Node& node = nodes[index];
+        Aabb centerBounds;
+        for (std::uint32_t i = node.first; i < node.first + node.count; ++i) {
+            centerBounds.grow(centers[order[i]]);
+        }
+
+        const Split split    = findSplit(node, centerBounds);
+        const float leafCost = intersectCost * blocks(node.count);
+        if (depth + 1 >= Bvh::maxDepth || node.count == 1 || (node.count <= maxLeafSize && split.cost >= leafCost)) {
+            ++stats.leafCount;
+            return;
+        }
+
+        auto begin = order.begin() + node.first;
+        auto end   = begin + node.count;
+        auto mid   = begin;
+        if (split.axis >= 0) {
+            mid = std::partition(begin, end, [&](std::uint32_t prim) { return centers[prim][split.axis] < split.pos; });
+        }
+        if (mid == begin || mid == end) {
+            // No usable plane (e.g. all centers coincide), fall back to a median split
+            const Vector3 extent = centerBounds.max - centerBounds.min;
+            const int axis       = static_cast<int>(std::max_element(extent.begin(), extent.end()) - extent.begin());
+            mid                  = begin + node.count / 2;
+            std::nth_element(begin, mid, end, [&](std::uint32_t a, std::uint32_t b) { return centers[a][axis] < centers[b][axis]; });
+        }
+
+        const std::uint32_t leftCount = static_cast<std::uint32_t>(mid - begin);
+        const std::uint32_t first     = node.first;
+        const std::uint32_t count     = node.count;
+        const std::uint32_t child     = static_cast<std::uint32_t>(nodes.size());
+        nodes.emplace_back();
+        nodes.emplace_back();
+        // node is invalidated by the emplacement
+        nodes[index].first = child;
+        nodes[index].count = 0;
+
+        nodes[child].first     = first;
+        nodes[child].count     = leftCount;
+        nodes[child + 1].first = first + leftCount;
+        nodes[child + 1].count = count - leftCount;
+        for (std::uint32_t c = child; c < child + 2; ++c) {
+            for (std::uint32_t i = nodes[c].first; i < nodes[c].first + nodes[c].count; ++i) {
+                nodes[c].bounds.grow(bounds[order[i]]);
+            }
+        }
+        subdivide(child, depth + 1);
+        subdivide(child + 1, depth + 1);
+    }
+};
+} // namespace
+
+std::vector<std::uint32_t> Bvh::build(const std::vector<Aabb>& bounds, std::uint32_t maxLeafSize, std::uint32_t blockSize)
+{
+    const auto start = std::chrono::steady_clock::now();
+
+    nodes_.clear();
+    stats_ = Stats{};
+    std::vector<std::uint32_t> order(bounds.size());
+    std::iota(order.begin(), order.end(), 0u);
+    if (!bounds.empty()) {
+        blockSize = std::max(blockSize, 1u);
+        Builder builder{ bounds, {}, order, nodes_, std::max(maxLeafSize, 1u), blockSize, stats_ };
+        builder.centers.reserve(bounds.size());
+        for (const auto& box : bounds) {
+            builder.centers.push_back(box.center());
+        }
+
+        nodes_.reserve(2 * bounds.size() - 1);
+        nodes_.emplace_back();
+        nodes_[0].first = 0;
+        nodes_[0].count = static_cast<std::uint32_t>(bounds.size());
+        for (const auto& box : bounds) {
+            nodes_[0].bounds.grow(box);
+        }
+        builder.subdivide(0, 0);
+        nodes_.shrink_to_fit(); // a leaf holds many primitives, far fewer nodes than reserved are used
+
+        if (blockSize > 1) {
+            // Let every leaf start at a block boundary
+            std::vector<std::uint32_t> padded;
+            for (auto& node : nodes_) {
+                if (!node.isLeaf()) {
+                    continue;
+                }
+                const std::uint32_t first = static_cast<std::uint32_t>(padded.size());
+                padded.insert(padded.end(), order.begin() + node.first, order.begin() + node.first + node.count);
+                padded.resize(first + static_cast<std::uint32_t>(builder.blocks(node.count)) * blockSize, invalidIndex);
+                node.first = first;
+            }
+            order = std::move(padded);
+        }
+    }
+
+    parents_.clear();
+    cost_      = surfaceCost();
+    builtCost_ = relativeCost();
+
+    stats_.nodeCount   = nodes_.size();
+    stats_.buildTimeMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    return order;
+}
+
+void Bvh::refit(std::uint32_t leaf, const Aabb& bounds)
+{
+    assert(leaf < nodes_.size() && nodes_[leaf].isLeaf());
+    if (parents_.size() != nodes_.size()) {
+        parents_.assign(nodes_.size(), invalidIndex);
+        for (std::uint32_t i = 0; i < nodes_.size(); ++i) {
+            if (!nodes_[i].isLeaf()) {
+                parents_[nodes_[i].first]     = i;
+                parents_[nodes_[i].first + 1] = i;
+            }
+        }
+    }
+
+    // Walk up while the boxes change, ancestors of an unchanged box are up to date
+    Aabb box = bounds;
+    for (std::uint32_t index = leaf; index != invalidIndex; index = parents_[index]) {
+        Node& node = nodes_[index];
+        if (index != leaf) {
+            box = nodes_[node.first].bounds;
+            box.grow(nodes_[node.first + 1].bounds);
+        }
+        if (equal(box, node.bounds)) {
+            break;
+        }
+        const double weight = node.isLeaf() ? intersectCost * node.count : traversalCost;
+        cost_ += weight * (static_cast<double>(box.area()) - node.bounds.area());
+        node.bounds = box;
+    }
+}
+
+double Bvh::surfaceCost() const noexcept
+{
+    double cost = 0.0;
+    for (const auto& node : nodes_) {
+        const double weight = node.isLeaf() ? intersectCost * node.count : traversalCost;
+        cost += weight * node.bounds.area();
+    }
+    return cost;
+}
@@ -0,0 +1,93 @@
+#ifndef TOY_TRACER_FILE_VIEW_HPP
+#define TOY_TRACER_FILE_VIEW_HPP
+
+#include <cstddef>
+#include <stdexcept>
+#include <string>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define TOY_TRACER_MMAP
+#else
+#include <fstream>
+#include <vector>
+#endif
+
+namespace toy_tracer
+{
+/**
+ * @brief Read only view of a whole file, memory mapped where mmap is available
+ * @throws std::runtime_error If the file cannot be opened or mapped
+ */
+class FileView {
+  public:
+    explicit FileView(const std::string& filename)
+    {
+#ifdef TOY_TRACER_MMAP
+        const int fd = ::open(filename.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw std::runtime_error("Could not open file " + filename);
+        }
+        struct stat info;
+        if (::fstat(fd, &info) != 0) {
+            ::close(fd);
+            throw std::runtime_error("Could not stat file " + filename);
+        }
+        size_ = static_cast<std::size_t>(info.st_size);
+        if (size_ > 0) {
+            void* data = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (data == MAP_FAILED) {
+                ::close(fd);
+                throw std::runtime_error("Could not map file " + filename);
+            }
+            data_ = static_cast<const char*>(data);
+        }
+        ::close(fd);
+#else
+        std::ifstream file(filename, std::ios::binary | std::ios::ate);
+        if (!file.is_open()) {
+            throw std::runtime_error("Could not open file " + filename);
+        }
+        buffer_.resize(static_cast<std::size_t>(file.tellg()));
+        file.seekg(0);
+        file.read(buffer_.data(), static_cast<std::streamsize>(buffer_.size()));
+        data_ = buffer_.data();
+        size_ = buffer_.size();
+#endif
+    }
+
+    ~FileView()
+    {
+#ifdef TOY_TRACER_MMAP
+        if (data_ != nullptr) {
+            ::munmap(const_cast<char*>(data_), size_);
+        }
+#endif
+    }
+
+    FileView(const FileView&)            = delete;
+    FileView& operator=(const FileView&) = delete;
+
+    const char* data() const noexcept
+    {
+        return data_;
+    }
+
+    std::size_t size() const noexcept
+    {
+        return size_;
+    }
+
+  private:
+    const char* data_ = nullptr;
+    std::size_t size_ = 0;
+#ifndef TOY_TRACER_MMAP
+    std::vector<char> buffer_;
+#endif
+};
+} // namespace toy_tracer
+
+#endif
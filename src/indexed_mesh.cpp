@@ -0,0 +1,208 @@
+#include <cassert>
+#include <cstring>
+#include <toy_tracer/indexed_mesh.hpp>
+#include <utility>
+
+using toy_tracer::IndexedMesh;
+using toy_tracer::Triangle;
+using Vector3 = toy_tracer::math::Vector<float, 3>;
+
+namespace
+{
+/**
+ * @brief Hash of the bits of a position with -0 folded into +0, so equal
+ * positions have equal hashes
+ */
+std::uint64_t hashPosition(const Vector3& position) noexcept
+{
+    std::uint32_t key[3];
+    for (std::size_t i = 0; i < 3; ++i) {
+        const float value = position[i] + 0.0f;
+        std::memcpy(&key[i], &value, sizeof(float));
+    }
+    std::uint64_t h = key[0];
+    h               = h * 0x9e3779b97f4a7c15ull + key[1];
+    h               = h * 0x9e3779b97f4a7c15ull + key[2];
+    h ^= h >> 32;
+    h *= 0xd6e8feb86659fd93ull;
+    h ^= h >> 32;
+    return h;
+}
+
+/**
+ * @brief Open addressing table from positions to the first inserted position
+ * with the same value, the slots hold indices into the positions
+ */
+class VertexTable {
+  public:
+    VertexTable(const std::vector<Vector3>& positions, std::size_t capacity)
+            : positions_(positions)
+    {
+        std::size_t size = 16;
+        while (size < capacity * 2) {
+            size *= 2;
+        }
+        slots_.assign(size, empty);
+    }
+
+    /**
+     * @return The first index inserted with the value of positions[index]
+     */
+    std::uint32_t insert(std::uint32_t index, std::uint64_t hash)
+    {
+        const Vector3& position = positions_[index];
+        const std::size_t mask  = slots_.size() - 1;
+        for (std::size_t slot = static_cast<std::size_t>(hash) & mask;; slot = (slot + 1) & mask) {
+            if (slots_[slot] == empty) {
+                slots_[slot] = index;
+                return index;
+            }
+            const Vector3& other = positions_[slots_[slot]];
+            if (other[0] == position[0] && other[1] == position[1] && other[2] == position[2]) {
+                return slots_[slot];
+            }
+        }
+    }
+
+  private:
+    static constexpr std::uint32_t empty = UINT32_MAX;
+
+    const std::vector<Vector3>& positions_;
+    std::vector<std::uint32_t> slots_;
+};
+
+/**
+ * @brief Weld in passes over chunks of the positions, run(job) calls
+ * job(worker) for every worker and returns once all are done.
+ *
+ * The positions are split into one shard per worker by the upper half of
+ * their hash, equal positions always land in the same shard. Each worker
+ * maps the positions of its shard to the first one with the same value, the
+ * first positions are then numbered in order. This gives the numbering of a
+ * serial weld for any number of workers.
+ */
+template<typename Run>
+IndexedMesh weldPositions(const std::vector<Vector3>& positions, std::size_t workers, const Run& run)
+{
+    const std::size_t count = positions.size();
+    const auto chunkBegin   = [&](std::size_t worker) { return count * worker / workers; };
+    const auto shardOf      = [&](std::uint64_t hash) {
+        return static_cast<std::size_t>(((hash >> 32) * workers) >> 32);
+    };
+
+    // Sort the positions by shard, each shard keeps them in order
+    std::vector<std::size_t> offsets(workers * workers, 0); // shard major, a column per chunk
+    run([&](std::size_t worker) {
+        std::vector<std::size_t> shardCounts(workers, 0);
+        for (std::size_t i = chunkBegin(worker); i < chunkBegin(worker + 1); ++i) {
+            ++shardCounts[shardOf(hashPosition(positions[i]))];
+        }
+        for (std::size_t shard = 0; shard < workers; ++shard) {
+            offsets[shard * workers + worker] = shardCounts[shard];
+        }
+    });
+    std::vector<std::size_t> shardBegin(workers + 1, 0);
+    std::size_t offset = 0;
+    for (std::size_t i = 0; i < offsets.size(); ++i) {
+        if (i % workers == 0) {
+            shardBegin[i / workers] = offset;
+        }
+        offset += std::exchange(offsets[i], offset);
+    }
+    shardBegin[workers] = offset;
+    std::vector<std::uint32_t> order(count);
+    run([&](std::size_t worker) {
+        for (std::size_t i = chunkBegin(worker); i < chunkBegin(worker + 1); ++i) {
+            order[offsets[shardOf(hashPosition(positions[i])) * workers + worker]++] = static_cast<std::uint32_t>(i);
+        }
+    });
+
+    std::vector<std::uint32_t> first(count);
+    run([&](std::size_t worker) {
+        VertexTable table(positions, shardBegin[worker + 1] - shardBegin[worker]);
+        for (std::size_t k = shardBegin[worker]; k < shardBegin[worker + 1]; ++k) {
+            first[order[k]] = table.insert(order[k], hashPosition(positions[order[k]]));
+        }
+    });
+
+    // Number the first positions, order is reused for the vertex of each of them
+    std::vector<std::size_t> vertexBegin(workers + 1, 0);
+    run([&](std::size_t worker) {
+        std::size_t unique = 0;
+        for (std::size_t i = chunkBegin(worker); i < chunkBegin(worker + 1); ++i) {
+            unique += first[i] == i;
+        }
+        vertexBegin[worker + 1] = unique;
+    });
+    for (std::size_t worker = 0; worker < workers; ++worker) {
+        vertexBegin[worker + 1] += vertexBegin[worker];
+    }
+    std::vector<Vector3> vertices(vertexBegin[workers]);
+    run([&](std::size_t worker) {
+        auto vertex = static_cast<std::uint32_t>(vertexBegin[worker]);
+        for (std::size_t i = chunkBegin(worker); i < chunkBegin(worker + 1); ++i) {
+            if (first[i] == i) {
+                vertices[vertex] = positions[i] + Vector3{ 0.0f, 0.0f, 0.0f };
+                order[i]         = vertex++;
+            }
+        }
+    });
+    std::vector<std::uint32_t> indices(count);
+    run([&](std::size_t worker) {
+        for (std::size_t i = chunkBegin(worker); i < chunkBegin(worker + 1); ++i) {
+            indices[i] = order[first[i]];
+        }
+    });
+    return IndexedMesh(std::move(vertices), std::move(indices));
+}
+} // namespace
+
+IndexedMesh::IndexedMesh(std::vector<Vector3> vertices, std::vector<std::uint32_t> indices)
+        : vertices_(std::move(vertices)), indices_(std::move(indices))
+{
+    assert(indices_.size() % 3 == 0);
+    computeNormals();
+}
+
+IndexedMesh IndexedMesh::weld(const std::vector<Vector3>& positions)
+{
+    assert(positions.size() % 3 == 0);
+    return weldPositions(positions, 1, [](const auto& job) { job(0); });
+}
+
+IndexedMesh IndexedMesh::weld(const std::vector<Vector3>& positions, ThreadPool& pool)
+{
+    assert(positions.size() % 3 == 0);
+    return weldPositions(positions, pool.size(), [&](const auto& job) { pool.run(job); });
+}
+
+IndexedMesh IndexedMesh::weld(const std::vector<Triangle>& triangles)
+{
+    std::vector<Vector3> positions;
+    positions.reserve(triangles.size() * 3);
+    for (const auto& triangle : triangles) {
+        positions.push_back(triangle.v0());
+        positions.push_back(triangle.v1());
+        positions.push_back(triangle.v2());
+    }
+    return weld(positions);
+}
+
+void IndexedMesh::computeNormals()
+{
+    normals_.assign(vertices_.size(), Vector3{ 0.0f, 0.0f, 0.0f });
+    for (std::size_t i = 0; i < indices_.size(); i += 3) {
+        const Vector3& v0 = vertices_[indices_[i]];
+        // The cross product is twice the area, so larger triangles weigh more
+        const Vector3 normal = math::cross(vertices_[indices_[i + 1]] - v0, vertices_[indices_[i + 2]] - v0);
+        normals_[indices_[i]] += normal;
+        normals_[indices_[i + 1]] += normal;
+        normals_[indices_[i + 2]] += normal;
+    }
+    for (auto& normal : normals_) {
+        const float length = math::length(normal);
+        if (length > 0.0f) {
+            normal /= length;
+        }
+    }
+}
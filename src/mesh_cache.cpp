@@ -0,0 +1,237 @@
+#include "file_view.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <toy_tracer/mesh_cache.hpp>
+#include <type_traits>
+
+using toy_tracer::Bvh;
+using toy_tracer::FileView;
+using toy_tracer::IndexBlock;
+using toy_tracer::MeshCache;
+using Vector3 = toy_tracer::math::Vector<float, 3>;
+
+namespace
+{
+constexpr char magic[8]            = { 'T', 'T', 'M', 'E', 'S', 'H', '\0', '\0' };
+constexpr std::uint32_t byteOrder  = 0x01020304;
+constexpr std::size_t alignment    = 64;
+constexpr std::size_t sectionCount = 4;
+
+static_assert(std::is_trivially_copyable<Vector3>::value, "Vertices are stored as they are in memory");
+static_assert(std::is_trivially_copyable<IndexBlock>::value, "Blocks are stored as they are in memory");
+static_assert(std::is_trivially_copyable<Bvh::Node>::value, "Nodes are stored as they are in memory");
+
+struct Section {
+    std::uint64_t offset;
+    std::uint64_t count;
+};
+
+struct Header {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t byteOrder;
+    std::uint32_t vectorSize;
+    std::uint32_t blockSize;
+    std::uint32_t nodeSize;
+    std::uint32_t reserved;
+    std::uint64_t sourceHash;
+    std::uint64_t fileSize;
+    std::uint64_t nodeCount;
+    std::uint64_t leafCount;
+    std::uint64_t maxDepth;
+    std::uint64_t triangleCount;
+    double buildTimeMs;
+    Section sections[sectionCount]; // vertices, normals, blocks, nodes
+};
+
+std::uint64_t alignUp(std::uint64_t offset)
+{
+    return (offset + alignment - 1) / alignment * alignment;
+}
+
+Header makeHeader() noexcept
+{
+    Header header{};
+    std::memcpy(header.magic, magic, sizeof(magic));
+    header.version    = MeshCache::version;
+    header.byteOrder  = byteOrder;
+    header.vectorSize = sizeof(Vector3);
+    header.blockSize  = sizeof(IndexBlock);
+    header.nodeSize   = sizeof(Bvh::Node);
+    return header;
+}
+
+template<typename T>
+bool copySection(const FileView& file, const Section& section, std::vector<T>& data)
+{
+    if (section.offset % alignment != 0 || section.offset > file.size()
+        || section.count > (file.size() - section.offset) / sizeof(T)) {
+        return false;
+    }
+    data.resize(section.count);
+    std::memcpy(static_cast<void*>(data.data()), file.data() + section.offset, section.count * sizeof(T));
+    return true;
+}
+
+/**
+ * @brief Check that traversing the hierarchy and unpacking the blocks stays
+ * inside the arrays, a damaged file must not crash the render
+ */
+bool validStructure(const MeshCache& cache)
+{
+    const std::size_t vertexCount = cache.vertices.size();
+    for (const IndexBlock& block : cache.blocks) {
+        for (const auto& corner : block.index) {
+            for (std::uint32_t index : corner) {
+                if (index >= vertexCount) {
+                    return false;
+                }
+            }
+        }
+    }
+
+    // Children come after their parent, so the depth of a node is known before its children are checked
+    const std::uint64_t laneCount = static_cast<std::uint64_t>(cache.blocks.size()) * IndexBlock::width;
+    std::vector<std::uint32_t> depths(cache.nodes.size(), 0);
+    for (std::size_t i = 0; i < cache.nodes.size(); ++i) {
+        const Bvh::Node& node = cache.nodes[i];
+        if (node.isLeaf()) {
+            if (node.first % IndexBlock::width != 0 || std::uint64_t{ node.first } + node.count > laneCount) {
+                return false;
+            }
+            continue;
+        }
+        if (node.first <= i || std::uint64_t{ node.first } + 1 >= cache.nodes.size()) {
+            return false;
+        }
+        for (std::uint32_t child = node.first; child <= node.first + 1; ++child) {
+            if (depths[child] != 0 || depths[i] + 1 >= Bvh::maxDepth) {
+                return false; // a node with two parents, or deeper than the traversal stack
+            }
+            depths[child] = depths[i] + 1;
+        }
+    }
+    return true;
+}
+} // namespace
+
+std::optional<MeshCache> MeshCache::read(const std::string& filename, std::uint64_t sourceHash)
+{
+    const auto start = std::chrono::steady_clock::now();
+    std::unique_ptr<const FileView> view;
+    try {
+        view = std::make_unique<const FileView>(filename);
+    } catch (const std::runtime_error&) {
+        return std::nullopt; // missing, unreadable or e.g. a directory, the mesh is loaded from its source
+    }
+    const FileView& file = *view;
+    Header header;
+    if (file.size() < sizeof(Header)) {
+        return std::nullopt;
+    }
+    std::memcpy(&header, file.data(), sizeof(Header));
+
+    const Header expected = makeHeader();
+    if (std::memcmp(header.magic, expected.magic, sizeof(magic)) != 0 || header.version != expected.version
+        || header.byteOrder != expected.byteOrder || header.vectorSize != expected.vectorSize
+        || header.blockSize != expected.blockSize || header.nodeSize != expected.nodeSize
+        || header.sourceHash != sourceHash || header.fileSize != file.size()) {
+        return std::nullopt;
+    }
+
+    MeshCache cache;
+    if (!copySection(file, header.sections[0], cache.vertices) || !copySection(file, header.sections[1], cache.normals)
+        || !copySection(file, header.sections[2], cache.blocks) || !copySection(file, header.sections[3], cache.nodes)
+        || cache.normals.size() != cache.vertices.size()
+        || header.triangleCount > cache.blocks.size() * IndexBlock::width || !validStructure(cache)) {
+        return std::nullopt;
+    }
+    cache.sourceHash           = sourceHash;
+    cache.triangleCount        = header.triangleCount;
+    cache.bvhStats.nodeCount   = header.nodeCount;
+    cache.bvhStats.leafCount   = header.leafCount;
+    cache.bvhStats.maxDepth    = header.maxDepth;
+    cache.bvhStats.buildTimeMs = header.buildTimeMs;
+    cache.stats.bytes          = file.size();
+    cache.stats.loadTimeMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    return cache;
+}
+
+void MeshCache::write(const std::string& filename) const
+{
+    Header header        = makeHeader();
+    header.sourceHash    = sourceHash;
+    header.triangleCount = triangleCount;
+    header.nodeCount     = bvhStats.nodeCount;
+    header.leafCount     = bvhStats.leafCount;
+    header.maxDepth      = bvhStats.maxDepth;
+    header.buildTimeMs   = bvhStats.buildTimeMs;
+
+    const void* data[sectionCount]        = { vertices.data(), normals.data(), blocks.data(), nodes.data() };
+    const std::size_t sizes[sectionCount] = { sizeof(Vector3), sizeof(Vector3), sizeof(IndexBlock), sizeof(Bvh::Node) };
+    header.sections[0].count = vertices.size();
+    header.sections[1].count = normals.size();
+    header.sections[2].count = blocks.size();
+    header.sections[3].count = nodes.size();
+    std::uint64_t offset     = alignUp(sizeof(Header));
+    for (std::size_t i = 0; i < sectionCount; ++i) {
+        header.sections[i].offset = offset;
+        offset                    = alignUp(offset + header.sections[i].count * sizes[i]);
+    }
+    header.fileSize = offset;
+
+    // Written next to the target and renamed, so a reader sees the old or the new file
+    const std::string temporary = filename + ".tmp";
+    {
+        std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+        if (!file.is_open()) {
+            throw std::runtime_error("Could not open file " + temporary);
+        }
+        const char padding[alignment] = {};
+        file.write(reinterpret_cast<const char*>(&header), sizeof(Header));
+        std::uint64_t position = sizeof(Header);
+        for (std::size_t i = 0; i < sectionCount; ++i) {
+            file.write(padding, static_cast<std::streamsize>(header.sections[i].offset - position));
+            file.write(static_cast<const char*>(data[i]), static_cast<std::streamsize>(header.sections[i].count * sizes[i]));
+            position = header.sections[i].offset + header.sections[i].count * sizes[i];
+        }
+        file.write(padding, static_cast<std::streamsize>(header.fileSize - position));
+        if (!file) {
+            throw std::runtime_error("Could not write file " + temporary);
+        }
+    }
+    if (std::rename(temporary.c_str(), filename.c_str()) != 0) {
+        std::remove(temporary.c_str());
+        throw std::runtime_error("Could not replace file " + filename);
+    }
+}
+
+std::uint64_t MeshCache::hashFile(const std::string& filename)
+{
+    const FileView file(filename);
+    const std::uint64_t prime = 0x9e3779b97f4a7c15ull;
+    std::uint64_t hash        = file.size() * prime;
+    const auto mix            = [&](std::uint64_t word) {
+        hash ^= word * 0xff51afd7ed558ccdull;
+        hash = ((hash << 31) | (hash >> 33)) * prime;
+    };
+    std::size_t i = 0;
+    for (; i + sizeof(std::uint64_t) <= file.size(); i += sizeof(std::uint64_t)) {
+        std::uint64_t word;
+        std::memcpy(&word, file.data() + i, sizeof(word));
+        mix(word);
+    }
+    std::uint64_t tail = 0;
+    if (i < file.size()) {
+        std::memcpy(&tail, file.data() + i, file.size() - i);
+    }
+    mix(tail);
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53ull;
+    hash ^= hash >> 33;
+    return hash;
+}
@@ -1,22 +1,244 @@
+#include "tile_scheduler.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <numeric>
 #include <optional>
-#include <random>
-#include <thread>
+#include <toy_tracer/aabb.hpp>
 #include <toy_tracer/camera.hpp>
 #include <toy_tracer/ray.hpp>
 #include <toy_tracer/renderer.hpp>
+#include <toy_tracer/trace_recorder.hpp>
 
+using toy_tracer::RayPacket;
+using toy_tracer::RenderCounters;
 using toy_tracer::Renderer;
+using toy_tracer::RenderStats;
+using toy_tracer::Sampler;
+using toy_tracer::Tile;
+using toy_tracer::TileScheduler;
+using toy_tracer::TraceScope;
 using Vector3     = toy_tracer::math::Vector<float, 3>;
 using ColorVector = toy_tracer::math::Vector<float, 3>;
 
-inline float random_float()
+namespace
+{
+/**
+ * @brief Running mean and variance of the brightness of a pixel's samples (Welford)
+ */
+struct PixelVariance {
+    int count  = 0;
+    float mean = 0.0f;
+    float m2   = 0.0f;
+
+    void add(const ColorVector& sample) noexcept
+    {
+        float y     = (sample[0] + sample[1] + sample[2]) / 3.0f;
+        float delta = y - mean;
+        ++count;
+        mean += delta / static_cast<float>(count);
+        m2 += delta * (y - mean);
+    }
+
+    /**
+     * @brief Standard error of the mean
+     */
+    float error() const noexcept
+    {
+        if (count < 2) {
+            return std::numeric_limits<float>::infinity();
+        }
+        return std::sqrt(m2 / (static_cast<float>(count - 1) * static_cast<float>(count)));
+    }
+};
+
+/**
+ * @brief State of a path traced by the wavefront renderer
+ */
+struct WavefrontPath {
+    toy_tracer::Ray ray;
+    Sampler sampler;
+    float throughput;
+};
+
+/**
+ * @brief Buffers of the wavefront renderer, one per worker so they are reused across tiles
+ */
+struct WavefrontQueue {
+    std::vector<WavefrontPath> paths;
+    std::vector<ColorVector> results;
+    std::vector<std::uint32_t> active; // paths still bouncing, compacted after every bounce
+    std::vector<std::pair<std::uint64_t, std::uint32_t>> keys;
+    std::vector<std::optional<toy_tracer::HitRecord>> records;
+    std::vector<std::uint32_t> pixels; // pixels sampled in the current batch
+    std::vector<ColorVector> colors;
+    std::vector<PixelVariance> variances;
+};
+
+/**
+ * @brief Gathers the statistics of a frame from the render threads, does
+ * nothing unless stats are enabled and requested
+ */
+class StatsRecorder {
+    using Clock = std::chrono::steady_clock;
+
+  public:
+    StatsRecorder(RenderStats* stats, std::size_t workers)
+            : stats_(RenderCounters::enabled ? stats : nullptr)
+    {
+        if (stats_) {
+            counters_.resize(workers);
+            threads_.resize(workers);
+            start_ = Clock::now();
+        }
+    }
+
+    /**
+     * @brief Let the counting functions of the calling worker thread count into its counters
+     */
+    void beginWorker(std::size_t worker) noexcept
+    {
+#ifdef TOY_TRACER_ENABLE_STATS
+        if (stats_) {
+            RenderCounters::current = &counters_[worker];
+        }
+#else
+        (void)worker;
+#endif
+    }
+
+    void endWorker() noexcept
+    {
+#ifdef TOY_TRACER_ENABLE_STATS
+        RenderCounters::current = nullptr;
+#endif
+    }
+
+    template<typename Render>
+    void tile(std::size_t worker, Render&& render)
+    {
+        if (!stats_) {
+            render();
+            return;
+        }
+        const auto start = Clock::now();
+        render();
+        threads_[worker].busyMs += std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+        ++threads_[worker].tiles;
+    }
+
+    /**
+     * @brief Merge the counters of the workers into the stats
+     */
+    void finish()
+    {
+        if (!stats_) {
+            return;
+        }
+        stats_->wallMs   = std::chrono::duration<double, std::milli>(Clock::now() - start_).count();
+        stats_->counters = RenderCounters{};
+        for (const auto& counters : counters_) {
+            stats_->counters.merge(counters);
+        }
+        for (auto& thread : threads_) {
+            thread.idleMs = std::max(0.0, stats_->wallMs - thread.busyMs);
+        }
+        stats_->threads = std::move(threads_);
+    }
+
+  private:
+    RenderStats* stats_;
+    std::vector<RenderCounters> counters_;
+    std::vector<RenderStats::Thread> threads_;
+    Clock::time_point start_;
+};
+
+/**
+ * @brief Sort key of a ray, the octant of its direction followed by the
+ * Morton code of its origin within bounds
+ */
+std::uint64_t sortKey(const toy_tracer::Ray& ray, const toy_tracer::Aabb& bounds) noexcept
+{
+    std::uint64_t key = 0;
+    for (std::size_t i = 0; i < 3; ++i) {
+        const float extent   = bounds.max[i] - bounds.min[i];
+        const float offset   = extent > 0.0f ? (ray.origin()[i] - bounds.min[i]) / extent : 0.0f;
+        const auto quantized = static_cast<std::uint32_t>(std::min(std::max(offset, 0.0f) * 1023.0f, 1023.0f));
+        for (std::uint32_t bit = 0; bit < 10; ++bit) {
+            key |= static_cast<std::uint64_t>((quantized >> bit) & 1u) << (3 * bit + i);
+        }
+        key |= static_cast<std::uint64_t>(ray.direction()[i] < 0.0f) << (30 + i);
+    }
+    return key;
+}
+} // namespace
+
+void Renderer::render(void* buffer, size_t size, const World& world, RenderStats* stats) const noexcept
 {
-    static std::uniform_real_distribution<float> dist(0.0f, 1.0f);
-    static std::mt19937 gen;
-    return dist(gen);
+    TraceScope scope("Renderer::render");
+    trace(
+        world, 0, minSamples_, maxSamples_, errorThreshold_,
+        [&](int w, int h, const ColorVector& sum, int samples) {
+            writePixel(buffer, size, w, h, sum / static_cast<float>(samples));
+        },
+        stats);
 }
 
-void Renderer::render(void* buffer, size_t size, const World& world) const noexcept
+void Renderer::accumulate(const World& world, int samples, RenderStats* stats)
+{
+    if (camera_ == nullptr || samples <= 0) {
+        return;
+    }
+    TraceScope scope("Renderer::accumulate");
+    accumulation_.resize(static_cast<std::size_t>(width_) * height_ * 3, 0.0f);
+    trace(
+        world, accumulatedSamples_, samples, samples, 0.0f,
+        [&](int w, int h, const ColorVector& sum, int) {
+            float* pixel = &accumulation_[(static_cast<std::size_t>(h) * width_ + w) * 3];
+            pixel[0] += sum[0];
+            pixel[1] += sum[1];
+            pixel[2] += sum[2];
+        },
+        stats);
+    accumulatedSamples_ += samples;
+}
+
+void Renderer::resolve(void* buffer, size_t size) const noexcept
+{
+    if (accumulatedSamples_ == 0) {
+        return;
+    }
+    // Divided like in render, a multiplication by the reciprocal can round differently
+    const auto samples = static_cast<float>(accumulatedSamples_);
+    for (int h = 0; h < height_; ++h) {
+        for (int w = 0; w < width_; ++w) {
+            const float* pixel = &accumulation_[(static_cast<std::size_t>(h) * width_ + w) * 3];
+            writePixel(buffer, size, w, h, ColorVector{ pixel[0], pixel[1], pixel[2] } / samples);
+        }
+    }
+}
+
+void Renderer::resetAccumulation() noexcept
+{
+    std::fill(accumulation_.begin(), accumulation_.end(), 0.0f);
+    accumulatedSamples_ = 0;
+}
+
+void Renderer::writePixel(void* buffer, size_t size, int w, int h, const ColorVector& color) const noexcept
+{
+    size_t index = (static_cast<size_t>(h) * width_ + w) * 3;
+    if (index + 2 >= size) {
+        return;
+    }
+    static_cast<std::uint8_t*>(buffer)[index + 0] = color[0];
+    static_cast<std::uint8_t*>(buffer)[index + 1] = color[1];
+    static_cast<std::uint8_t*>(buffer)[index + 2] = color[2];
+}
+
+void Renderer::trace(const World& world, int firstSample, int minSamples, int maxSamples, float errorThreshold,
+                     const PixelSink& store, RenderStats* stats) const
 {
     if (camera_ == nullptr) {
         return;
@@ -27,38 +249,206 @@ void Renderer::render(void* buffer, size_t size, const World& world) const noexc
     float viewportHeight    = camera_->viewportHeight();
     float focalLength       = camera_->focalLength();
     Vector3 lowerLeftCorner = origin - Vector3{ viewportWidth / 2.0f, viewportHeight / 2.0f, -focalLength };
-    const int samples       = 100;
+    const int tileSize      = 16;
+
+    auto primaryRay = [&](int w, int h, Sampler& sampler) {
+        // normalize pixel coordinates
+        float u           = (static_cast<float>(w) + sampler.next()) / static_cast<float>(width_ - 1);
+        float v           = (static_cast<float>(h) + sampler.next()) / static_cast<float>(height_ - 1);
+        Vector3 direction = (lowerLeftCorner + Vector3{ u * viewportWidth, v * viewportHeight, 0.0f }) - origin;
+        return Ray(origin, direction);
+    };
 
-    auto task = [&](int thread, int thread_count) {
-        for (int w = thread; w < width_; w += thread_count) {
-            for (int h = height_ - 1; h >= 0; --h) {
+    auto converged = [&](const PixelVariance& variance) {
+        return variance.count >= maxSamples
+               || (variance.count >= minSamples && variance.error() <= errorThreshold);
+    };
+
+    // Trace all paths of the queue bounce by bounce, the paths that ended are
+    // dropped after every bounce
+    auto traceWavefront = [&](WavefrontQueue& queue) {
+        queue.active.resize(queue.paths.size());
+        std::iota(queue.active.begin(), queue.active.end(), 0u);
+        for (std::size_t depth = 1; !queue.active.empty(); ++depth) {
+            if (raySorting_) {
+                Aabb bounds;
+                for (auto index : queue.active) {
+                    bounds.grow(queue.paths[index].ray.origin());
+                }
+                queue.keys.clear();
+                for (auto index : queue.active) {
+                    queue.keys.emplace_back(sortKey(queue.paths[index].ray, bounds), index);
+                }
+                std::sort(queue.keys.begin(), queue.keys.end());
+                for (std::size_t i = 0; i < queue.keys.size(); ++i) {
+                    queue.active[i] = queue.keys[i].second;
+                }
+            }
+
+            // Camera rays of neighbouring samples are coherent enough for packets,
+            // bounced rays are not, even when sorted
+            queue.records.assign(queue.active.size(), std::nullopt);
+            if (depth == 1) {
+                for (std::size_t first = 0; first < queue.active.size(); first += RayPacket::size) {
+                    RayPacket packet;
+                    const std::size_t last = std::min(first + RayPacket::size, queue.active.size());
+                    for (std::size_t i = first; i < last; ++i) {
+                        packet.push(queue.paths[queue.active[i]].ray);
+                    }
+                    world.hit_renderables(packet, &queue.records[first]);
+                }
+            } else {
+                for (std::size_t i = 0; i < queue.active.size(); ++i) {
+                    queue.records[i] = world.hit_renderables(queue.paths[queue.active[i]].ray);
+                }
+            }
+            for (const auto& record : queue.records) {
+                RenderCounters::countRay(depth - 1, record.has_value());
+            }
+
+            std::size_t count = 0;
+            for (std::size_t i = 0; i < queue.active.size(); ++i) {
+                const std::uint32_t index = queue.active[i];
+                WavefrontPath& path       = queue.paths[index];
+                if (!queue.records[i]) {
+                    queue.results[index] = world.background(path.throughput);
+                } else if (!world.scatter(path.ray, *queue.records[i], depth, path.throughput, path.sampler)) {
+                    queue.results[index] = ColorVector{ 0.0f, 0.0f, 0.0f };
+                } else {
+                    queue.active[count++] = index;
+                }
+            }
+            queue.active.resize(count);
+        }
+    };
+
+    auto renderTile = [&](const Tile& tile) {
+        for (int h = tile.y0; h < tile.y1; ++h) {
+            for (int w = tile.x0; w < tile.x1; ++w) {
                 ColorVector color = { 0, 0, 0 };
-                for (int s = 0; s < samples; ++s) {
-                    // normalize pixel coordinates
-                    float u            = (static_cast<float>(w) + random_float()) / static_cast<float>(width_ - 1);
-                    float v            = (static_cast<float>(h) + random_float()) / static_cast<float>(height_ - 1);
-                    Vector3 direction  = (lowerLeftCorner + Vector3{ u * viewportWidth, v * viewportHeight, 0.0f }) - origin;
-                    Ray ray(origin, direction);
-                    color += world.hit(ray);
+                PixelVariance variance;
+                for (int s = firstSample; !converged(variance); ++s) {
+                    Sampler sampler(w, h, s, seed_);
+                    ColorVector sample = world.hit(primaryRay(w, h, sampler), sampler);
+                    color += sample;
+                    variance.add(sample);
                 }
-                color /= static_cast<float>(samples);
-                size_t index = (h * width_ + w) * 3;
-                if (index >= size) {
-                    return;
+                store(w, h, color, variance.count);
+            }
+        }
+    };
+
+    constexpr int side = 4;
+    static_assert(side * side == RayPacket::size, "A packet covers a block of side x side pixels");
+    auto renderPacketTile = [&](const Tile& tile) {
+        for (int bh = tile.y0; bh < tile.y1; bh += side) {
+            for (int bw = tile.x0; bw < tile.x1; bw += side) {
+                const int wEnd                      = std::min(bw + side, tile.x1);
+                const int hEnd                      = std::min(bh + side, tile.y1);
+                ColorVector colors[RayPacket::size] = {};
+                PixelVariance variances[RayPacket::size];
+                for (int s = firstSample;; ++s) {
+                    // only the pixels that have not converged yet take part in the packet
+                    RayPacket packet;
+                    Sampler samplers[RayPacket::size];
+                    std::size_t pixels[RayPacket::size];
+                    std::size_t i = 0;
+                    for (int h = bh; h < hEnd; ++h) {
+                        for (int w = bw; w < wEnd; ++w, ++i) {
+                            if (converged(variances[i])) {
+                                continue;
+                            }
+                            pixels[packet.count]   = i;
+                            samplers[packet.count] = Sampler(w, h, s, seed_);
+                            packet.push(primaryRay(w, h, samplers[packet.count]));
+                        }
+                    }
+                    if (packet.count == 0) {
+                        break;
+                    }
+                    ColorVector result[RayPacket::size];
+                    world.hit(packet, samplers, result);
+                    for (std::size_t j = 0; j < packet.count; ++j) {
+                        colors[pixels[j]] += result[j];
+                        variances[pixels[j]].add(result[j]);
+                    }
+                }
+                std::size_t i = 0;
+                for (int h = bh; h < hEnd; ++h) {
+                    for (int w = bw; w < wEnd; ++w, ++i) {
+                        store(w, h, colors[i], variances[i].count);
+                    }
                 }
-                static_cast<std::uint8_t*>(buffer)[index + 0] = color[0];
-                static_cast<std::uint8_t*>(buffer)[index + 1] = color[1];
-                static_cast<std::uint8_t*>(buffer)[index + 2] = color[2];
             }
         }
     };
 
-    const int thread_count = std::thread::hardware_concurrency();
-    std::vector<std::thread> t(thread_count);
-    for (int i = 0; i < thread_count; ++i) {
-        t[i] = std::thread(task, i, thread_count);
-    }
-    for (int i = 0; i < thread_count; ++i) {
-        t[i].join();
-    }
+    // Batches of samples for all pixels of a tile that have not converged yet,
+    // the sums are built in sample order so the image matches the other modes
+    const int wavefrontBatch = 8;
+    auto renderWavefrontTile = [&](const Tile& tile, WavefrontQueue& queue) {
+        const int tileWidth   = tile.x1 - tile.x0;
+        const auto pixelCount = static_cast<std::size_t>(tileWidth) * (tile.y1 - tile.y0);
+        queue.colors.assign(pixelCount, ColorVector{ 0.0f, 0.0f, 0.0f });
+        queue.variances.assign(pixelCount, PixelVariance{});
+        for (int s = firstSample, batch = minSamples;; s += batch, batch = wavefrontBatch) {
+            batch = std::min(batch, maxSamples - (s - firstSample));
+            queue.pixels.clear();
+            queue.paths.clear();
+            for (std::uint32_t i = 0; i < pixelCount; ++i) {
+                if (converged(queue.variances[i])) {
+                    continue;
+                }
+                queue.pixels.push_back(i);
+                const int w = tile.x0 + static_cast<int>(i) % tileWidth;
+                const int h = tile.y0 + static_cast<int>(i) / tileWidth;
+                for (int j = 0; j < batch; ++j) {
+                    Sampler sampler(w, h, s + j, seed_);
+                    const Ray ray = primaryRay(w, h, sampler);
+                    queue.paths.push_back({ ray, sampler, 1.0f });
+                }
+            }
+            if (queue.pixels.empty()) {
+                break;
+            }
+            queue.results.resize(queue.paths.size());
+            traceWavefront(queue);
+            for (std::size_t k = 0; k < queue.pixels.size(); ++k) {
+                const std::uint32_t i = queue.pixels[k];
+                for (int j = 0; j < batch && !converged(queue.variances[i]); ++j) {
+                    const ColorVector& sample = queue.results[k * batch + j];
+                    queue.colors[i] += sample;
+                    queue.variances[i].add(sample);
+                }
+            }
+        }
+        for (std::uint32_t i = 0; i < pixelCount; ++i) {
+            const int w = tile.x0 + static_cast<int>(i) % tileWidth;
+            const int h = tile.y0 + static_cast<int>(i) / tileWidth;
+            store(w, h, queue.colors[i], queue.variances[i].count);
+        }
+    };
+
+    TileScheduler scheduler(width_, height_, tileSize, pool_->size());
+    StatsRecorder recorder(stats, pool_->size());
+    pool_->run([&](std::size_t worker) {
+        recorder.beginWorker(worker);
+        std::size_t index = 0;
+        WavefrontQueue queue;
+        while (scheduler.next(worker, index)) {
+            recorder.tile(worker, [&] {
+                const Tile tile = scheduler.tile(index);
+                TraceScope scope("tile", tile.x0, tile.y0);
+                if (wavefrontTracing_) {
+                    renderWavefrontTile(tile, queue);
+                } else if (packetTracing_) {
+                    renderPacketTile(tile);
+                } else {
+                    renderTile(tile);
+                }
+            });
+        }
+        recorder.endWorker();
+    });
+    recorder.finish();
 }
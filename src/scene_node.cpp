@@ -1,8 +1,13 @@
+#include <algorithm>
+#include <atomic>
 #include <cassert>
 #include <toy_tracer/scene_node.hpp>
+#include <toy_tracer/thread_pool.hpp>
+#include <toy_tracer/trace_recorder.hpp>
 
 using toy_tracer::SceneGraph;
 using toy_tracer::SceneNode;
+using toy_tracer::TraceScope;
 using Vector3 = toy_tracer::math::Vector<float, 3>;
 using Vector2 = toy_tracer::math::Vector<float, 2>;
 using Matrix3 = toy_tracer::math::Matrix<float, 3, 3>;
@@ -108,13 +113,17 @@ void SceneNode::attach(SceneObject* obj)
 {
     sceneObjects_.push_back(obj);
     obj->notifyAttached(this);
+    if (graph_)
+        graph_->notifyAdded(obj);
     notifyNeedsUpdate(UpdateType::childNodes);
 }
 
 void SceneNode::detach(SceneObject* obj)
 {
+    if (graph_)
+        graph_->notifyRemoved(obj);
     obj->notifyDetached();
-    sceneObjects_.remove(obj);
+    sceneObjects_.erase(std::remove(sceneObjects_.begin(), sceneObjects_.end(), obj), sceneObjects_.end());
     notifyNeedsUpdate(UpdateType::childNodes);
 }
 
@@ -122,14 +131,14 @@ void SceneNode::attach(SceneNode* node)
 {
     childNodes_.push_back(node);
     node->notifyAttached(this);
-    notifyNeedsUpdate(UpdateType::childNodes);
+    // The node is placed relative to its new parent
+    node->notifyNeedsUpdate(UpdateType::pos);
 }
 
 void SceneNode::detach(SceneNode* node)
 {
     node->notifyDetached();
-    childNodes_.remove(node);
-    notifyNeedsUpdate(UpdateType::childNodes);
+    childNodes_.erase(std::remove(childNodes_.begin(), childNodes_.end(), node), childNodes_.end());
 }
 
 void SceneNode::notifyAttached(SceneNode* parent)
@@ -147,77 +156,117 @@ void SceneNode::notifyDetached()
 
 void SceneNode::notifyNeedsUpdate(UpdateType type)
 {
-    if ((neededUpdate_ & UpdateType::pos) == UpdateType::none && (type & UpdateType::pos) == UpdateType::pos) {
-        for (auto node : childNodes_)
-            node->notifyNeedsUpdate(UpdateType::pos);
-        neededUpdate_ = neededUpdate_ | UpdateType::pos;
+    if (graph_ && neededUpdate_ == UpdateType::none)
+        graph_->notifyNeedsUpdate(this);
+    neededUpdate_ = neededUpdate_ | type;
+}
+
+void SceneNode::updateTransform()
+{
+    if (!parent_) // if this is the root node
+    {
+        absPos_       = pos_;
+        absScale_     = scale_;
+        absRot_       = rot_;
+        absIsFlipped_ = isFlipped_;
+        absIsVisible_ = isVisible_;
+
+    } else {
+        const Vector3 scale = parent_->absScale_;
+        //const float f       = (parent_->absIsFlipped_ ? -1 : 1);
+        Matrix3 rot         = parent_->absRot_;
+
+        absPos_       = parent_->absPos_ + rot * pos_;
+        absPos_       = parent_->absPos_ + pos_;
+        absScale_     = { scale[0] * scale_[0], scale[1] * scale_[1], scale[2] * scale_[2] };
+        absRot_       = parent_->rot_ * rot_;
+        absIsFlipped_ = !(parent_->absIsFlipped_ == isFlipped_);
+        absIsVisible_ = parent_->absIsVisible_ && isVisible_;
     }
-    if ((neededUpdate_ & UpdateType::childNodes) == UpdateType::none && (type & UpdateType::childNodes) == UpdateType::childNodes) {
-        if (parent_)
-            parent_->notifyNeedsUpdate(UpdateType::childNodes);
-        neededUpdate_ = neededUpdate_ | UpdateType::childNodes;
+}
+
+void SceneNode::updateObjects()
+{
+    for (auto obj : sceneObjects_)
+        obj->notifyNodeUpdated();
+}
+
+void SceneNode::notifyObjects()
+{
+    for (auto obj : sceneObjects_) {
+        obj->notifyNodeUpdated();
+        if (graph_)
+            graph_->notifyUpdated(obj);
     }
 }
 
 void SceneNode::update()
 {
-    if (neededUpdate_ == UpdateType::none)
+    if (graph_) {
+        graph_->update();
         return;
-    if ((neededUpdate_ & UpdateType::pos) != UpdateType::none) {
-        if (!parent_) // if this is the root node
-        {
-            absPos_       = pos_;
-            absScale_     = scale_;
-            absRot_       = rot_;
-            absIsFlipped_ = isFlipped_;
-            absIsVisible_ = isVisible_;
-
-        } else {
-            const Vector3 scale = parent_->absScale_;
-            //const float f       = (parent_->absIsFlipped_ ? -1 : 1);
-            Matrix3 rot         = parent_->absRot_;
-
-            absPos_       = parent_->absPos_ + rot * pos_;
-            absPos_       = parent_->absPos_ + pos_;
-            absScale_     = { scale[0] * scale_[0], scale[1] * scale_[1], scale[2] * scale_[2] };
-            absRot_       = parent_->rot_ * rot_;
-            absIsFlipped_ = !(parent_->absIsFlipped_ == isFlipped_);
-            absIsVisible_ = parent_->absIsVisible_ && isVisible_;
-        }
-        for (auto obj : sceneObjects_)
-            obj->notifyNodeUpdated();
-        for (auto node : childNodes_)
-            node->update();
-        neededUpdate_ = UpdateType::none;
-    } else if ((neededUpdate_ & UpdateType::childNodes) != UpdateType::none) {
-        for (auto obj : sceneObjects_)
-            obj->notifyNodeUpdated();
-        for (auto node : childNodes_)
-            node->update();
-        neededUpdate_ = UpdateType::none;
+    }
+    TraceScope scope("SceneNode::update");
+
+    // Nothing tracks the changed nodes of a tree outside of a graph, so all of it is visited
+    struct Entry {
+        SceneNode* node;
+        bool pos;
+    };
+    std::vector<Entry> stack = { { this, false } };
+    while (!stack.empty()) {
+        const Entry entry = stack.back();
+        stack.pop_back();
+        SceneNode* node = entry.node;
+        const bool pos  = entry.pos || (node->neededUpdate_ & UpdateType::pos) != UpdateType::none;
+        if (pos)
+            node->updateTransform();
+        if (pos || node->neededUpdate_ != UpdateType::none)
+            node->notifyObjects();
+        node->neededUpdate_ = UpdateType::none;
+        for (auto it = node->childNodes_.rbegin(); it != node->childNodes_.rend(); ++it)
+            stack.push_back({ *it, pos });
     }
 }
 
 void SceneNode::setGraph(SceneGraph* graph)
 {
-    graph_ = graph;
-    if (graph_) {
-        for (auto obj : sceneObjects_)
-            graph_->notifyAdded(obj);
-        for (auto node : childNodes_)
-            node->setGraph(graph);
+    if (!graph) {
+        graph_ = nullptr;
+        return;
+    }
+    graph->notifyStructureChanged();
+    std::vector<SceneNode*> stack = { this };
+    while (!stack.empty()) {
+        SceneNode* node = stack.back();
+        stack.pop_back();
+        node->graph_ = graph;
+        if (node->neededUpdate_ != UpdateType::none)
+            graph->notifyNeedsUpdate(node);
+        for (auto obj : node->sceneObjects_)
+            graph->notifyAdded(obj);
+        stack.insert(stack.end(), node->childNodes_.rbegin(), node->childNodes_.rend());
     }
 }
 
 void SceneNode::unsetGraph()
 {
-    if (graph_) {
-        for (auto obj : sceneObjects_)
-            graph_->notifyRemoved(obj);
-        for (auto node : childNodes_)
-            node->unsetGraph();
+    if (!graph_)
+        return;
+    SceneGraph* graph = graph_;
+    graph->notifyStructureChanged();
+    std::vector<SceneNode*> stack = { this };
+    while (!stack.empty()) {
+        SceneNode* node = stack.back();
+        stack.pop_back();
+        for (auto obj : node->sceneObjects_)
+            graph->notifyRemoved(obj);
+        if (node->neededUpdate_ != UpdateType::none)
+            graph->notifyNoUpdate(node);
+        node->graph_ = nullptr;
+        node->index_ = invalidIndex;
+        stack.insert(stack.end(), node->childNodes_.rbegin(), node->childNodes_.rend());
     }
-    graph_ = nullptr;
 }
 
 SceneGraph* SceneNode::graph()
@@ -240,6 +289,12 @@ void SceneGraph::notifyRemoved(SceneObject* node)
         obs->notifyRemoved(node);
 }
 
+void SceneGraph::notifyUpdated(SceneObject* node)
+{
+    for (auto obs : observers_)
+        obs->notifyUpdated(node);
+}
+
 void SceneGraph::addObserver(SceneGraphObserver* observer)
 {
     observers_.push_back(observer);
@@ -251,3 +306,172 @@ void SceneGraph::rmObserver(SceneGraphObserver* observer)
     assert(iter != observers_.end() && "Observer to remove must exist");
     observers_.erase(iter);
 }
+
+void SceneGraph::update()
+{
+    TraceScope scope("SceneGraph::update");
+    update(changedRanges());
+}
+
+void SceneGraph::update(const std::vector<Range>& ranges)
+{
+    for (const Range& range : ranges) {
+        for (std::uint32_t i = range.first; i < range.end; ++i) {
+            nodes_[i]->updateTransform();
+            nodes_[i]->notifyObjects();
+        }
+    }
+}
+
+void SceneGraph::update(ThreadPool& pool)
+{
+    TraceScope scope("SceneGraph::update");
+    const std::vector<Range> ranges = changedRanges();
+    std::size_t count               = 0;
+    for (const Range& range : ranges)
+        count += range.end - range.first;
+    const std::size_t grain = std::max<std::size_t>(1024, count / (8 * pool.size()));
+    if (count <= grain) {
+        update(ranges);
+        return;
+    }
+
+    // Split large subtrees into their root and the subtrees of its children,
+    // the roots are updated here so the children only read finished parents.
+    // The ranges come out front to back, neighbouring small ones are merged
+    // into tasks of about grain nodes.
+    std::vector<Range> tasks;
+    std::vector<Range> pending(ranges.rbegin(), ranges.rend());
+    while (!pending.empty()) {
+        const Range range = pending.back();
+        pending.pop_back();
+        if (range.end - range.first <= grain) {
+            if (!tasks.empty() && tasks.back().end == range.first && range.end - tasks.back().first <= grain)
+                tasks.back().end = range.end;
+            else
+                tasks.push_back(range);
+            continue;
+        }
+        nodes_[range.first]->updateTransform();
+        nodes_[range.first]->updateObjects();
+        const std::size_t children = pending.size();
+        for (std::uint32_t child = range.first + 1; child < range.end; child = ends_[child])
+            pending.push_back({ child, ends_[child] });
+        std::reverse(pending.begin() + static_cast<std::ptrdiff_t>(children), pending.end());
+    }
+
+    std::atomic<std::size_t> next{ 0 };
+    pool.run([&](std::size_t) {
+        for (std::size_t task = next++; task < tasks.size(); task = next++) {
+            TraceScope taskScope("SceneGraph::update subtrees");
+            for (std::uint32_t i = tasks[task].first; i < tasks[task].end; ++i) {
+                nodes_[i]->updateTransform();
+                nodes_[i]->updateObjects();
+            }
+        }
+    });
+
+    for (const Range& range : ranges) {
+        for (std::uint32_t i = range.first; i < range.end; ++i) {
+            for (auto obj : nodes_[i]->sceneObjects_)
+                notifyUpdated(obj);
+        }
+    }
+}
+
+std::vector<SceneGraph::Range> SceneGraph::changedRanges()
+{
+    std::vector<Range> ranges;
+    if (changed_.empty())
+        return ranges;
+    if (!sorted_)
+        sort();
+    if (changed_.size() * 8 > nodes_.size()) {
+        // Cheaper to look at every node in order than to sort the changed ones
+        changed_ = nodes_;
+    } else {
+        std::sort(changed_.begin(), changed_.end(), [](const SceneNode* a, const SceneNode* b) { return a->index_ < b->index_; });
+    }
+
+    std::uint32_t end = 0; // end of the last moved subtree
+    for (auto changed : changed_) {
+        const std::uint32_t first = changed->index_;
+        if (first < end || changed->neededUpdate_ == SceneNode::UpdateType::none)
+            continue; // moved with an ancestor
+        if ((changed->neededUpdate_ & SceneNode::UpdateType::pos) == SceneNode::UpdateType::none) {
+            changed->notifyObjects();
+            changed->neededUpdate_ = SceneNode::UpdateType::none;
+            continue;
+        }
+        end = ends_[first];
+        ranges.push_back({ first, end });
+        for (std::uint32_t i = first; i < end; ++i)
+            nodes_[i]->neededUpdate_ = SceneNode::UpdateType::none;
+    }
+    changed_.clear();
+    return ranges;
+}
+
+SceneNode* SceneGraph::createNode(std::string_view id)
+{
+    if (freeNodes_.empty()) {
+        SceneNode* node = &pool_.emplace_back(id);
+        node->owner_    = this;
+        return node;
+    }
+    SceneNode* node = freeNodes_.back();
+    freeNodes_.pop_back();
+    node->id_     = id;
+    node->isFree_ = false;
+    return node;
+}
+
+void SceneGraph::destroyNode(SceneNode* node)
+{
+    assert(node != &root_ && "The root node belongs to the graph");
+    assert(node->owner_ == this && "Only nodes created by createNode() can be destroyed");
+    assert(!node->isFree_ && "A node can only be destroyed once");
+    if (node->parent_)
+        node->parent_->detach(node);
+    while (!node->childNodes_.empty())
+        node->detach(node->childNodes_.back());
+    while (!node->sceneObjects_.empty())
+        node->detach(node->sceneObjects_.back());
+    *node         = SceneNode();
+    node->owner_  = this;
+    node->isFree_ = true;
+    freeNodes_.push_back(node);
+}
+
+void SceneGraph::notifyNeedsUpdate(SceneNode* node)
+{
+    changed_.push_back(node);
+}
+
+void SceneGraph::notifyNoUpdate(SceneNode* node)
+{
+    changed_.erase(std::remove(changed_.begin(), changed_.end(), node), changed_.end());
+}
+
+void SceneGraph::sort()
+{
+    nodes_.clear();
+    std::vector<SceneNode*> stack = { &root_ };
+    while (!stack.empty()) {
+        SceneNode* node = stack.back();
+        stack.pop_back();
+        node->index_ = static_cast<std::uint32_t>(nodes_.size());
+        nodes_.push_back(node);
+        stack.insert(stack.end(), node->childNodes_.rbegin(), node->childNodes_.rend());
+    }
+
+    // Sum the subtree sizes from the back, children come after their parent
+    ends_.assign(nodes_.size(), 1);
+    for (std::size_t i = nodes_.size(); i-- > 0;) {
+        const std::uint32_t size = ends_[i];
+        ends_[i]                 = static_cast<std::uint32_t>(i) + size;
+        if (nodes_[i]->parent_)
+            ends_[nodes_[i]->parent_->index_] += size;
+    }
+    sorted_ = true;
+}
@@ -0,0 +1,77 @@
+#include "file_view.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <toy_tracer/stl_file.hpp>
+#include <toy_tracer/trace_recorder.hpp>
+
+using toy_tracer::Aabb;
+using toy_tracer::FileView;
+using toy_tracer::StlFile;
+using toy_tracer::ThreadPool;
+using toy_tracer::TraceScope;
+using Vector3 = toy_tracer::math::Vector<float, 3>;
+
+namespace
+{
+constexpr std::size_t headerSize = 84; // 80 byte comment and the triangle count
+constexpr std::size_t recordSize = 50; // normal, three vertices and the attribute byte count
+
+Vector3 readVector(const char* data) noexcept
+{
+    float v[3];
+    std::memcpy(v, data, sizeof(v));
+    return Vector3{ v[0], v[1], v[2] };
+}
+} // namespace
+
+StlFile StlFile::read(const std::string& filename, ThreadPool& pool)
+{
+    TraceScope scope("StlFile::read");
+    const auto start = std::chrono::steady_clock::now();
+    const FileView file(filename);
+    if (file.size() < headerSize) {
+        throw std::runtime_error("File " + filename + " is too small to be a binary STL file");
+    }
+    std::uint32_t count = 0;
+    std::memcpy(&count, file.data() + 80, sizeof(count));
+    if (file.size() != headerSize + recordSize * static_cast<std::size_t>(count)) {
+        throw std::runtime_error("Size of file " + filename + " does not match its " + std::to_string(count)
+                                 + " triangles, not a binary STL file or truncated");
+    }
+
+    StlFile stl;
+    std::vector<Vector3> positions(3 * static_cast<std::size_t>(count));
+    stl.bounds.resize(count);
+    std::vector<Aabb> chunkBounds(pool.size());
+    pool.run([&](std::size_t worker) {
+        const std::size_t begin = count * worker / pool.size();
+        const std::size_t end   = count * (worker + 1) / pool.size();
+        Aabb& meshBounds        = chunkBounds[worker];
+        for (std::size_t i = begin; i < end; ++i) {
+            // Skip the stored normal, it is recomputed from the winding
+            const char* record   = file.data() + headerSize + i * recordSize;
+            const Vector3 v0     = readVector(record + 12);
+            const Vector3 v1     = readVector(record + 24);
+            const Vector3 v2     = readVector(record + 36);
+            positions[3 * i]     = v0;
+            positions[3 * i + 1] = v1;
+            positions[3 * i + 2] = v2;
+            Aabb& bounds         = stl.bounds[i];
+            bounds.grow(v0);
+            bounds.grow(v1);
+            bounds.grow(v2);
+            meshBounds.grow(bounds);
+        }
+    });
+    for (const auto& bounds : chunkBounds) {
+        stl.meshBounds.grow(bounds);
+    }
+    stl.mesh = toy_tracer::IndexedMesh::weld(positions, pool);
+
+    stl.stats.bytes      = file.size();
+    stl.stats.loadTimeMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    return stl;
+}
@@ -0,0 +1,91 @@
+#include <algorithm>
+#include <string>
+#include <toy_tracer/thread_pool.hpp>
+#include <toy_tracer/trace_recorder.hpp>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+using toy_tracer::ThreadPool;
+using toy_tracer::TraceRecorder;
+
+ThreadPool::ThreadPool(std::size_t threadCount, bool pinThreads)
+        : pinned_(pinThreads)
+{
+    if (threadCount == 0) {
+        threadCount = std::max(1u, std::thread::hardware_concurrency());
+    }
+    threads_.reserve(threadCount);
+    for (std::size_t i = 0; i < threadCount; ++i) {
+        threads_.emplace_back(&ThreadPool::work, this, i);
+    }
+
+#ifdef __linux__
+    if (pinThreads) {
+        const std::size_t cpus = std::max(1u, std::thread::hardware_concurrency());
+        for (std::size_t i = 0; i < threads_.size(); ++i) {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(i % cpus, &set);
+            if (pthread_setaffinity_np(threads_[i].native_handle(), sizeof(set), &set) != 0) {
+                pinned_ = false;
+            }
+        }
+    }
+#else
+    pinned_ = false;
+#endif
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    start_.notify_all();
+    for (auto& thread : threads_) {
+        thread.join();
+    }
+}
+
+void ThreadPool::run(const std::function<void(std::size_t)>& job)
+{
+    std::lock_guard<std::mutex> runLock(runMutex_);
+    std::unique_lock<std::mutex> lock(mutex_);
+    job_       = &job;
+    remaining_ = threads_.size();
+    ++generation_;
+    start_.notify_all();
+    done_.wait(lock, [this] { return remaining_ == 0; });
+    job_ = nullptr;
+}
+
+void ThreadPool::work(std::size_t worker)
+{
+    if (TraceRecorder::enabled) {
+        TraceRecorder::nameThread("worker " + std::to_string(worker));
+    }
+    std::size_t generation = 0;
+    while (true) {
+        const std::function<void(std::size_t)>* job = nullptr;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            start_.wait(lock, [&] { return stop_ || generation_ != generation; });
+            if (stop_) {
+                return;
+            }
+            generation = generation_;
+            job        = job_;
+        }
+        (*job)(worker);
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (--remaining_ == 0) {
+                done_.notify_one();
+            }
+        }
+    }
+}
@@ -0,0 +1,133 @@
+#ifndef TOY_TRACER_TILE_SCHEDULER_HPP
+#define TOY_TRACER_TILE_SCHEDULER_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace toy_tracer
+{
+struct Tile {
+    int x0;
+    int y0;
+    int x1;
+    int y1;
+};
+
+/**
+ * @brief Hands out the square tiles of an image to a fixed set of workers.
+ *
+ * Every worker starts with a contiguous range of tiles and takes them from the
+ * front. A worker that runs dry steals the back half of another worker's range.
+ * Ranges are packed into one atomic word each, so both sides are lock-free.
+ */
+class TileScheduler final {
+  public:
+    TileScheduler(int width, int height, int tileSize, std::size_t workerCount)
+            : width_(width),
+              height_(height),
+              tileSize_(tileSize),
+              columns_((width + tileSize - 1) / tileSize),
+              tileCount_(static_cast<std::uint32_t>(columns_ * ((height + tileSize - 1) / tileSize))),
+              workerCount_(std::max<std::size_t>(workerCount, 1)),
+              ranges_(new Range[workerCount_])
+    {
+        for (std::size_t i = 0; i < workerCount_; ++i) {
+            const auto begin = static_cast<std::uint32_t>(tileCount_ * i / workerCount_);
+            const auto end   = static_cast<std::uint32_t>(tileCount_ * (i + 1) / workerCount_);
+            ranges_[i].value.store(pack(begin, end), std::memory_order_relaxed);
+        }
+    }
+
+    std::size_t tileCount() const noexcept
+    {
+        return tileCount_;
+    }
+
+    Tile tile(std::size_t index) const noexcept
+    {
+        const int x = static_cast<int>(index % columns_) * tileSize_;
+        const int y = static_cast<int>(index / columns_) * tileSize_;
+        return Tile{ x, y, std::min(x + tileSize_, width_), std::min(y + tileSize_, height_) };
+    }
+
+    /**
+     * @brief Get the next tile of a worker, stealing if its own range is empty
+     * @return false once no tiles are left anywhere
+     */
+    bool next(std::size_t worker, std::size_t& index) noexcept
+    {
+        if (popFront(worker, index)) {
+            return true;
+        }
+        for (std::size_t i = 1; i < workerCount_; ++i) {
+            if (steal(worker, (worker + i) % workerCount_, index)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+  private:
+    struct alignas(64) Range {
+        std::atomic<std::uint64_t> value{ 0 };
+    };
+
+    static std::uint64_t pack(std::uint32_t begin, std::uint32_t end) noexcept
+    {
+        return (static_cast<std::uint64_t>(end) << 32) | begin;
+    }
+
+    static std::uint32_t begin(std::uint64_t range) noexcept
+    {
+        return static_cast<std::uint32_t>(range);
+    }
+
+    static std::uint32_t end(std::uint64_t range) noexcept
+    {
+        return static_cast<std::uint32_t>(range >> 32);
+    }
+
+    bool popFront(std::size_t worker, std::size_t& index) noexcept
+    {
+        auto& value         = ranges_[worker].value;
+        std::uint64_t range = value.load(std::memory_order_acquire);
+        while (begin(range) < end(range)) {
+            if (value.compare_exchange_weak(range, pack(begin(range) + 1, end(range)), std::memory_order_acq_rel)) {
+                index = begin(range);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool steal(std::size_t thief, std::size_t victim, std::size_t& index) noexcept
+    {
+        auto& value         = ranges_[victim].value;
+        std::uint64_t range = value.load(std::memory_order_acquire);
+        while (begin(range) < end(range)) {
+            const std::uint32_t count = end(range) - begin(range);
+            const std::uint32_t split = end(range) - (count + 1) / 2;
+            if (value.compare_exchange_weak(range, pack(begin(range), split), std::memory_order_acq_rel)) {
+                // The thief's own range is empty, no other worker can take from it until it is published
+                index = split;
+                ranges_[thief].value.store(pack(split + 1, end(range)), std::memory_order_release);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    int width_;
+    int height_;
+    int tileSize_;
+    int columns_;
+    std::uint32_t tileCount_;
+    std::size_t workerCount_;
+    std::unique_ptr<Range[]> ranges_;
+};
+} // namespace toy_tracer
+
+#endif
@@ -0,0 +1,174 @@
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <toy_tracer/trace_recorder.hpp>
+#include <vector>
+
+using toy_tracer::TraceRecorder;
+
+namespace
+{
+struct Event {
+    const char* name;
+    std::uint64_t begin;
+    std::uint64_t end;
+    std::int32_t x;
+    std::int32_t y;
+};
+
+/**
+ * @brief Ring buffer of one thread, only that thread writes events and moves
+ * the head, write() reads it while no traced code runs. It grows up to the
+ * capacity, so threads that record little take little memory.
+ */
+struct ThreadBuffer {
+    std::vector<Event> events;
+    std::atomic<std::uint64_t> head{ 0 }; // number of events ever recorded
+    std::uint32_t id = 0;
+    std::string name;
+};
+
+/**
+ * @brief Buffers of all threads that recorded something, they outlive their
+ * threads so the events of finished threads are written too
+ */
+struct Registry {
+    std::mutex mutex;
+    std::vector<std::unique_ptr<ThreadBuffer>> buffers;
+};
+
+Registry& registry()
+{
+    static Registry registry;
+    return registry;
+}
+
+thread_local ThreadBuffer* threadBuffer = nullptr;
+thread_local std::string threadName;
+
+ThreadBuffer* registerThread()
+{
+    auto buffer   = std::make_unique<ThreadBuffer>();
+    Registry& reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    buffer->id   = static_cast<std::uint32_t>(reg.buffers.size() + 1);
+    buffer->name = threadName.empty() ? "thread " + std::to_string(buffer->id) : threadName;
+    reg.buffers.push_back(std::move(buffer));
+    return reg.buffers.back().get();
+}
+
+void writeString(std::ostream& out, const std::string& text)
+{
+    out << '"';
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            out << '\\' << c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            char escaped[8];
+            std::snprintf(escaped, sizeof(escaped), "\\u%04x", static_cast<unsigned>(c));
+            out << escaped;
+        } else {
+            out << c;
+        }
+    }
+    out << '"';
+}
+} // namespace
+
+std::uint64_t TraceRecorder::now() noexcept
+{
+    static const auto epoch = std::chrono::steady_clock::now();
+    return static_cast<std::uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count());
+}
+
+void TraceRecorder::record(const char* name, std::uint64_t begin, std::uint64_t end, std::int32_t x,
+                           std::int32_t y) noexcept
+{
+    if (!threadBuffer) {
+        try {
+            threadBuffer = registerThread();
+        } catch (const std::exception&) {
+            return; // the trace misses this thread, tracing must not break the render
+        }
+    }
+    const std::uint64_t head = threadBuffer->head.load(std::memory_order_relaxed);
+    const Event event        = { name, begin, end, x, y };
+    if (head < capacity) {
+        try {
+            threadBuffer->events.push_back(event);
+        } catch (const std::exception&) {
+            return;
+        }
+    } else {
+        threadBuffer->events[head % capacity] = event;
+    }
+    threadBuffer->head.store(head + 1, std::memory_order_release);
+}
+
+void TraceRecorder::nameThread(const std::string& name)
+{
+    threadName = name;
+    if (threadBuffer) {
+        std::lock_guard<std::mutex> lock(registry().mutex);
+        threadBuffer->name = name;
+    }
+}
+
+void TraceRecorder::clear() noexcept
+{
+    Registry& reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    for (auto& buffer : reg.buffers) {
+        buffer->events.clear();
+        buffer->head.store(0, std::memory_order_relaxed);
+    }
+}
+
+void TraceRecorder::write(std::ostream& out)
+{
+    Registry& reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    out << "{\"traceEvents\":[";
+    bool first = true;
+    char line[128];
+    for (const auto& buffer : reg.buffers) {
+        out << (first ? "\n" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer->id
+            << ",\"args\":{\"name\":";
+        writeString(out, buffer->name);
+        out << "}}";
+        first = false;
+
+        const std::uint64_t head = buffer->head.load(std::memory_order_acquire);
+        for (std::uint64_t i = head > capacity ? head - capacity : 0; i < head; ++i) {
+            const Event& event = buffer->events[i % capacity];
+            out << ",\n{\"name\":";
+            writeString(out, event.name);
+            // Chrome trace times are in microseconds
+            std::snprintf(line, sizeof(line), ",\"cat\":\"toy_tracer\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f",
+                          static_cast<double>(event.begin) / 1000.0,
+                          static_cast<double>(event.end - event.begin) / 1000.0);
+            out << line << ",\"pid\":1,\"tid\":" << buffer->id;
+            if (event.x >= 0) {
+                out << ",\"args\":{\"x\":" << event.x << ",\"y\":" << event.y << '}';
+            }
+            out << '}';
+        }
+    }
+    out << "\n],\"displayTimeUnit\":\"ms\"}\n";
+}
+
+void TraceRecorder::writeFile(const std::string& filename)
+{
+    std::ofstream file(filename, std::ios::trunc);
+    if (!file.is_open()) {
+        throw std::runtime_error("Could not open file " + filename);
+    }
+    write(file);
+    if (!file) {
+        throw std::runtime_error("Could not write file " + filename);
+    }
+}
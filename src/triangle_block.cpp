@@ -0,0 +1,235 @@
+#include <algorithm>
+#include <atomic>
+#include <toy_tracer/triangle_block.hpp>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define TOY_TRACER_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+using toy_tracer::Ray;
+using toy_tracer::SimdLevel;
+using toy_tracer::TriangleBlock;
+
+namespace
+{
+using Kernel = int (*)(const TriangleBlock*, std::size_t, const Ray&, float, float&, std::size_t&);
+
+int intersectScalar(const TriangleBlock* blocks, std::size_t count, const Ray& ray, float detScale, float& tMax,
+                    std::size_t& block) noexcept
+{
+    int hitLane = -1;
+    for (std::size_t i = 0; i < count; ++i) {
+        const int lane = blocks[i].intersect(ray, detScale, tMax);
+        if (lane >= 0) {
+            block   = i;
+            hitLane = lane;
+        }
+    }
+    return hitLane;
+}
+
+#ifdef TOY_TRACER_X86_KERNELS
+// The kernels follow the operation order of TriangleBlock::intersect, so every
+// level reports the same hits. FMA is not enabled for the same reason.
+
+struct SseRay {
+    __m128 ox, oy, oz;
+    __m128 dx, dy, dz;
+    __m128 scale;
+};
+
+/**
+ * @brief Distances of four lanes starting at half, infinity where there is no hit
+ */
+__attribute__((target("sse2"))) inline __m128 hitSse(const TriangleBlock& b, std::size_t half, const SseRay& r,
+                                                     __m128 tMax) noexcept
+{
+    const __m128 zero   = _mm_setzero_ps();
+    const __m128 one    = _mm_set1_ps(1.0f);
+    const __m128 sign   = _mm_set1_ps(-0.0f);
+    const __m128 nx     = _mm_load_ps(&b.n[0][half]);
+    const __m128 ny     = _mm_load_ps(&b.n[1][half]);
+    const __m128 nz     = _mm_load_ps(&b.n[2][half]);
+    const __m128 det    = _mm_xor_ps(sign, _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, r.dx), _mm_mul_ps(ny, r.dy)), _mm_mul_ps(nz, r.dz)));
+    const __m128 invDet = _mm_div_ps(one, det);
+    const __m128 y0     = _mm_sub_ps(r.ox, _mm_load_ps(&b.v0[0][half]));
+    const __m128 y1     = _mm_sub_ps(r.oy, _mm_load_ps(&b.v0[1][half]));
+    const __m128 y2     = _mm_sub_ps(r.oz, _mm_load_ps(&b.v0[2][half]));
+    const __m128 c0     = _mm_sub_ps(_mm_mul_ps(y1, r.dz), _mm_mul_ps(y2, r.dy));
+    const __m128 c1     = _mm_sub_ps(_mm_mul_ps(y2, r.dx), _mm_mul_ps(y0, r.dz));
+    const __m128 c2     = _mm_sub_ps(_mm_mul_ps(y0, r.dy), _mm_mul_ps(y1, r.dx));
+    const __m128 t      = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, y0), _mm_mul_ps(ny, y1)), _mm_mul_ps(nz, y2)), invDet);
+    const __m128 u      = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_load_ps(&b.e1[0][half]), c0),
+                                                           _mm_mul_ps(_mm_load_ps(&b.e1[1][half]), c1)),
+                                                _mm_mul_ps(_mm_load_ps(&b.e1[2][half]), c2)),
+                                     invDet);
+    const __m128 v      = _mm_mul_ps(_mm_xor_ps(sign, _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_load_ps(&b.e0[0][half]), c0),
+                                                                            _mm_mul_ps(_mm_load_ps(&b.e0[1][half]), c1)),
+                                                                 _mm_mul_ps(_mm_load_ps(&b.e0[2][half]), c2))),
+                                     invDet);
+    __m128 valid = _mm_cmpge_ps(_mm_mul_ps(det, r.scale), _mm_set1_ps(std::numeric_limits<float>::epsilon()));
+    valid        = _mm_and_ps(valid, _mm_cmpge_ps(u, zero));
+    valid        = _mm_and_ps(valid, _mm_cmpge_ps(v, zero));
+    valid        = _mm_and_ps(valid, _mm_cmple_ps(_mm_add_ps(u, v), one));
+    valid        = _mm_and_ps(valid, _mm_cmpge_ps(t, zero));
+    valid        = _mm_and_ps(valid, _mm_cmplt_ps(t, tMax));
+    return _mm_or_ps(_mm_and_ps(valid, t), _mm_andnot_ps(valid, _mm_set1_ps(std::numeric_limits<float>::infinity())));
+}
+
+__attribute__((target("sse2"))) int intersectSse(const TriangleBlock* blocks, std::size_t count, const Ray& ray,
+                                                 float detScale, float& tMax, std::size_t& block) noexcept
+{
+    const SseRay r = {
+        _mm_set1_ps(ray.origin()[0]), _mm_set1_ps(ray.origin()[1]), _mm_set1_ps(ray.origin()[2]),
+        _mm_set1_ps(ray.direction()[0]), _mm_set1_ps(ray.direction()[1]), _mm_set1_ps(ray.direction()[2]),
+        _mm_set1_ps(detScale),
+    };
+
+    int hitLane = -1;
+    for (std::size_t i = 0; i < count; ++i) {
+        const __m128 limit = _mm_set1_ps(tMax);
+        const __m128 lo    = hitSse(blocks[i], 0, r, limit);
+        const __m128 hi    = hitSse(blocks[i], 4, r, limit);
+        if (_mm_movemask_ps(_mm_cmplt_ps(_mm_min_ps(lo, hi), limit)) == 0) {
+            continue;
+        }
+
+        // Horizontal minimum, the lowest lane holding it wins like in the scalar loop
+        __m128 m       = _mm_min_ps(lo, hi);
+        m              = _mm_min_ps(m, _mm_shuffle_ps(m, m, _MM_SHUFFLE(2, 3, 0, 1)));
+        m              = _mm_min_ps(m, _mm_shuffle_ps(m, m, _MM_SHUFFLE(1, 0, 3, 2)));
+        const float t0 = _mm_cvtss_f32(m);
+        if (t0 < tMax) {
+            const int mask = _mm_movemask_ps(_mm_cmpeq_ps(lo, m)) | (_mm_movemask_ps(_mm_cmpeq_ps(hi, m)) << 4);
+            tMax           = t0;
+            block          = i;
+            hitLane        = __builtin_ctz(static_cast<unsigned>(mask));
+        }
+    }
+    return hitLane;
+}
+
+__attribute__((target("avx2"))) int intersectAvx2(const TriangleBlock* blocks, std::size_t count, const Ray& ray,
+                                                  float detScale, float& tMax, std::size_t& block) noexcept
+{
+    const __m256 ox    = _mm256_set1_ps(ray.origin()[0]);
+    const __m256 oy    = _mm256_set1_ps(ray.origin()[1]);
+    const __m256 oz    = _mm256_set1_ps(ray.origin()[2]);
+    const __m256 dx    = _mm256_set1_ps(ray.direction()[0]);
+    const __m256 dy    = _mm256_set1_ps(ray.direction()[1]);
+    const __m256 dz    = _mm256_set1_ps(ray.direction()[2]);
+    const __m256 scale = _mm256_set1_ps(detScale);
+    const __m256 eps   = _mm256_set1_ps(std::numeric_limits<float>::epsilon());
+    const __m256 zero  = _mm256_setzero_ps();
+    const __m256 one   = _mm256_set1_ps(1.0f);
+    const __m256 inf   = _mm256_set1_ps(std::numeric_limits<float>::infinity());
+    const __m256 sign  = _mm256_set1_ps(-0.0f);
+
+    int hitLane = -1;
+    for (std::size_t i = 0; i < count; ++i) {
+        const TriangleBlock& b = blocks[i];
+        const __m256 nx        = _mm256_load_ps(b.n[0]);
+        const __m256 ny        = _mm256_load_ps(b.n[1]);
+        const __m256 nz        = _mm256_load_ps(b.n[2]);
+        const __m256 det       = _mm256_xor_ps(sign, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(nx, dx), _mm256_mul_ps(ny, dy)), _mm256_mul_ps(nz, dz)));
+        const __m256 invDet    = _mm256_div_ps(one, det);
+        const __m256 y0        = _mm256_sub_ps(ox, _mm256_load_ps(b.v0[0]));
+        const __m256 y1        = _mm256_sub_ps(oy, _mm256_load_ps(b.v0[1]));
+        const __m256 y2        = _mm256_sub_ps(oz, _mm256_load_ps(b.v0[2]));
+        const __m256 c0        = _mm256_sub_ps(_mm256_mul_ps(y1, dz), _mm256_mul_ps(y2, dy));
+        const __m256 c1        = _mm256_sub_ps(_mm256_mul_ps(y2, dx), _mm256_mul_ps(y0, dz));
+        const __m256 c2        = _mm256_sub_ps(_mm256_mul_ps(y0, dy), _mm256_mul_ps(y1, dx));
+        const __m256 t         = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(nx, y0), _mm256_mul_ps(ny, y1)), _mm256_mul_ps(nz, y2)), invDet);
+        const __m256 u         = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_load_ps(b.e1[0]), c0),
+                                                                           _mm256_mul_ps(_mm256_load_ps(b.e1[1]), c1)),
+                                                             _mm256_mul_ps(_mm256_load_ps(b.e1[2]), c2)),
+                                               invDet);
+        const __m256 v         = _mm256_mul_ps(_mm256_xor_ps(sign, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_load_ps(b.e0[0]), c0),
+                                                                                               _mm256_mul_ps(_mm256_load_ps(b.e0[1]), c1)),
+                                                                                 _mm256_mul_ps(_mm256_load_ps(b.e0[2]), c2))),
+                                               invDet);
+        __m256 valid = _mm256_cmp_ps(_mm256_mul_ps(det, scale), eps, _CMP_GE_OQ);
+        valid        = _mm256_and_ps(valid, _mm256_cmp_ps(u, zero, _CMP_GE_OQ));
+        valid        = _mm256_and_ps(valid, _mm256_cmp_ps(v, zero, _CMP_GE_OQ));
+        valid        = _mm256_and_ps(valid, _mm256_cmp_ps(_mm256_add_ps(u, v), one, _CMP_LE_OQ));
+        valid        = _mm256_and_ps(valid, _mm256_cmp_ps(t, zero, _CMP_GE_OQ));
+        valid        = _mm256_and_ps(valid, _mm256_cmp_ps(t, _mm256_set1_ps(tMax), _CMP_LT_OQ));
+        const __m256 tHit = _mm256_blendv_ps(inf, t, valid);
+
+        // Horizontal minimum, the lowest lane holding it wins like in the scalar loop
+        __m256 m       = _mm256_min_ps(tHit, _mm256_permute_ps(tHit, _MM_SHUFFLE(2, 3, 0, 1)));
+        m              = _mm256_min_ps(m, _mm256_permute_ps(m, _MM_SHUFFLE(1, 0, 3, 2)));
+        m              = _mm256_min_ps(m, _mm256_permute2f128_ps(m, m, 0x01));
+        const float t0 = _mm256_cvtss_f32(m);
+        if (t0 < tMax) {
+            const int mask = _mm256_movemask_ps(_mm256_cmp_ps(tHit, m, _CMP_EQ_OQ));
+            tMax           = t0;
+            block          = i;
+            hitLane        = __builtin_ctz(static_cast<unsigned>(mask));
+        }
+    }
+    return hitLane;
+}
+#endif
+
+Kernel kernelFor(SimdLevel level) noexcept
+{
+    switch (level) {
+#ifdef TOY_TRACER_X86_KERNELS
+        case SimdLevel::avx2:
+            return intersectAvx2;
+        case SimdLevel::sse:
+            return intersectSse;
+#endif
+        default:
+            return intersectScalar;
+    }
+}
+
+int resolveKernel(const TriangleBlock* blocks, std::size_t count, const Ray& ray, float detScale, float& tMax,
+                  std::size_t& block) noexcept;
+
+// Constant initialized, the kernel is resolved on first use
+std::atomic<SimdLevel> currentLevel{ SimdLevel::scalar };
+std::atomic<Kernel> currentKernel{ resolveKernel };
+
+int resolveKernel(const TriangleBlock* blocks, std::size_t count, const Ray& ray, float detScale, float& tMax,
+                  std::size_t& block) noexcept
+{
+    return kernelFor(toy_tracer::setSimdLevel(toy_tracer::supportedSimdLevel()))(blocks, count, ray, detScale, tMax, block);
+}
+} // namespace
+
+SimdLevel toy_tracer::supportedSimdLevel() noexcept
+{
+#ifdef TOY_TRACER_X86_KERNELS
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return SimdLevel::avx2;
+    if (__builtin_cpu_supports("sse2"))
+        return SimdLevel::sse;
+#endif
+    return SimdLevel::scalar;
+}
+
+SimdLevel toy_tracer::simdLevel() noexcept
+{
+    if (currentKernel.load(std::memory_order_relaxed) == resolveKernel)
+        return supportedSimdLevel();
+    return currentLevel.load(std::memory_order_relaxed);
+}
+
+SimdLevel toy_tracer::setSimdLevel(SimdLevel level) noexcept
+{
+    level = std::min(level, supportedSimdLevel());
+    currentLevel.store(level, std::memory_order_relaxed);
+    currentKernel.store(kernelFor(level), std::memory_order_relaxed);
+    return level;
+}
+
+int toy_tracer::intersectBlocks(const TriangleBlock* blocks, std::size_t count, const Ray& ray, float detScale, float& tMax,
+                                std::size_t& block) noexcept
+{
+    return currentKernel.load(std::memory_order_relaxed)(blocks, count, ray, detScale, tMax, block);
+}